@@ -17,3 +17,9 @@
  */
 
 #include <libtranslit/translittransliterator.h>
+#include <libtranslit/translitconverter.h>
+#include <libtranslit/translitsession.h>
+#include <libtranslit/translitpool.h>
+#include <libtranslit/translitresult.h>
+#include <libtranslit/translitarena.h>
+#include <libtranslit/translittrace.h>
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+#include <string.h>
+
+/**
+ * SECTION:translitarena
+ * @short_description: memory released all at once
+ *
+ * A #TranslitArena hands out memory from large chunks, which is only
+ * given back when the arena is reset or freed.  Passed to
+ * translit_transliterator_transliterate_arena() or
+ * translit_transliterator_transliterate_batch_arena(), it holds the
+ * outputs and the scratch data of a whole request, which can then be
+ * released with a single translit_arena_reset() instead of one
+ * g_free() per string.
+ *
+ * An arena must not be used from several threads at the same time.
+ */
+
+#define DEFAULT_CHUNK_SIZE 65536
+
+/* the alignment of the memory returned by translit_arena_alloc() */
+#define ARENA_ALIGNMENT (2 * sizeof (gpointer))
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+typedef struct _TranslitArenaChunk TranslitArenaChunk;
+
+struct _TranslitArenaChunk
+{
+  TranslitArenaChunk *next;
+  gsize size;
+};
+
+#define CHUNK_HEADER_SIZE ARENA_ALIGN (sizeof (TranslitArenaChunk))
+#define CHUNK_DATA(chunk) ((gchar *) (chunk) + CHUNK_HEADER_SIZE)
+
+struct _TranslitArena
+{
+  volatile gint ref_count;
+
+  gsize chunk_size;
+
+  /* The chunk being filled comes first, followed by the full ones.
+   * POS and END delimit the free space of the first chunk.  */
+  TranslitArenaChunk *chunks;
+  gchar *pos;
+  gchar *end;
+  gsize size;
+
+  /* a buffer for the outputs before they are copied to the arena,
+   * kept across resets */
+  GString *scratch;
+};
+
+G_DEFINE_BOXED_TYPE (TranslitArena, translit_arena,
+		     translit_arena_ref, translit_arena_unref);
+
+static TranslitArenaChunk *
+arena_chunk_new (TranslitArena *arena, gsize data_size)
+{
+  TranslitArenaChunk *chunk;
+
+  chunk = g_malloc (CHUNK_HEADER_SIZE + data_size);
+  chunk->next = NULL;
+  chunk->size = data_size;
+  arena->size += data_size;
+
+  return chunk;
+}
+
+static void
+arena_chunk_free (TranslitArena *arena, TranslitArenaChunk *chunk)
+{
+  arena->size -= chunk->size;
+  g_free (chunk);
+}
+
+/**
+ * translit_arena_new:
+ * @chunk_size: the size of the chunks, or 0 for the default
+ *
+ * Create an empty arena.  Memory is taken from the system in chunks
+ * of @chunk_size bytes; the allocations larger than a quarter of it
+ * get a chunk of their own.
+ *
+ * Returns: (transfer full): a new #TranslitArena
+ */
+TranslitArena *
+translit_arena_new (gsize chunk_size)
+{
+  TranslitArena *arena;
+
+  arena = g_slice_new0 (TranslitArena);
+  arena->ref_count = 1;
+  arena->chunk_size = ARENA_ALIGN (chunk_size > 0
+				   ? chunk_size
+				   : DEFAULT_CHUNK_SIZE);
+
+  return arena;
+}
+
+/**
+ * translit_arena_ref:
+ * @arena: a #TranslitArena
+ *
+ * Returns: (transfer full): @arena
+ */
+TranslitArena *
+translit_arena_ref (TranslitArena *arena)
+{
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  g_atomic_int_inc (&arena->ref_count);
+  return arena;
+}
+
+/**
+ * translit_arena_unref:
+ * @arena: a #TranslitArena
+ *
+ * Decrease the reference count of @arena.  When it drops to zero,
+ * all the memory allocated from @arena is freed.
+ */
+void
+translit_arena_unref (TranslitArena *arena)
+{
+  g_return_if_fail (arena != NULL);
+
+  if (g_atomic_int_dec_and_test (&arena->ref_count))
+    {
+      while (arena->chunks)
+	{
+	  TranslitArenaChunk *next = arena->chunks->next;
+
+	  arena_chunk_free (arena, arena->chunks);
+	  arena->chunks = next;
+	}
+      if (arena->scratch)
+	g_string_free (arena->scratch, TRUE);
+      g_slice_free (TranslitArena, arena);
+    }
+}
+
+/**
+ * translit_arena_alloc:
+ * @arena: a #TranslitArena
+ * @size: the number of bytes to allocate
+ *
+ * Allocate @size bytes from @arena, aligned for any basic type.  The
+ * memory is not initialized, and must not be freed with g_free().
+ *
+ * Returns: (transfer none): the allocated memory, valid until @arena
+ * is reset or freed
+ */
+gpointer
+translit_arena_alloc (TranslitArena *arena,
+		      gsize          size)
+{
+  TranslitArenaChunk *chunk;
+  gpointer data;
+
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  size = ARENA_ALIGN (MAX (size, 1));
+  if (G_LIKELY ((gsize) (arena->end - arena->pos) >= size))
+    {
+      data = arena->pos;
+      arena->pos += size;
+      return data;
+    }
+
+  /* A large block is put behind the current chunk, so that the free
+   * space of the latter is not wasted.  */
+  if (size > arena->chunk_size / 4)
+    {
+      chunk = arena_chunk_new (arena, size);
+      if (arena->chunks)
+	{
+	  chunk->next = arena->chunks->next;
+	  arena->chunks->next = chunk;
+	}
+      else
+	arena->chunks = chunk;
+      return CHUNK_DATA (chunk);
+    }
+
+  chunk = arena_chunk_new (arena, arena->chunk_size);
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->pos = CHUNK_DATA (chunk) + size;
+  arena->end = CHUNK_DATA (chunk) + chunk->size;
+
+  return CHUNK_DATA (chunk);
+}
+
+/**
+ * translit_arena_strndup:
+ * @arena: (allow-none): a #TranslitArena
+ * @str: a string
+ * @len: the number of bytes of @str to copy
+ *
+ * Copy the first @len bytes of @str to @arena, adding a nul
+ * terminator.  If @arena is %NULL, this is the same as g_strndup(),
+ * which lets backends share the code producing their outputs.
+ *
+ * Returns: (transfer none): the copy
+ */
+gchar *
+translit_arena_strndup (TranslitArena *arena,
+			const gchar   *str,
+			gsize          len)
+{
+  gchar *copy;
+
+  if (arena == NULL)
+    return g_strndup (str, len);
+
+  copy = translit_arena_alloc (arena, len + 1);
+  memcpy (copy, str, len);
+  copy[len] = '\0';
+
+  return copy;
+}
+
+/**
+ * translit_arena_reset:
+ * @arena: a #TranslitArena
+ *
+ * Release all the memory allocated from @arena at once.  One chunk is
+ * kept for the following allocations, so that an arena reset after
+ * each request does not go back to the system every time.
+ */
+void
+translit_arena_reset (TranslitArena *arena)
+{
+  TranslitArenaChunk *chunk, *next, *kept = NULL;
+
+  g_return_if_fail (arena != NULL);
+
+  for (chunk = arena->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      if (kept == NULL && chunk->size == arena->chunk_size)
+	kept = chunk;
+      else
+	arena_chunk_free (arena, chunk);
+    }
+
+  arena->chunks = kept;
+  if (kept)
+    {
+      kept->next = NULL;
+      arena->pos = CHUNK_DATA (kept);
+      arena->end = CHUNK_DATA (kept) + kept->size;
+    }
+  else
+    arena->pos = arena->end = NULL;
+}
+
+/**
+ * translit_arena_get_size:
+ * @arena: a #TranslitArena
+ *
+ * Returns: the number of bytes held by @arena, including the unused
+ * part of its chunks
+ */
+gsize
+translit_arena_get_size (TranslitArena *arena)
+{
+  g_return_val_if_fail (arena != NULL, 0);
+
+  return arena->size;
+}
+
+/**
+ * translit_arena_get_scratch:
+ * @arena: a #TranslitArena
+ *
+ * Get an empty buffer owned by @arena, in which an output can be built
+ * before it is copied to @arena with translit_arena_strndup().  The
+ * buffer is kept across resets, so that it only grows until it fits
+ * the longest output.  Backends call this from their
+ * transliterate_batch_arena implementation.
+ *
+ * Returns: (transfer none): the buffer of @arena
+ */
+GString *
+translit_arena_get_scratch (TranslitArena *arena)
+{
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  if (arena->scratch == NULL)
+    arena->scratch = g_string_new (NULL);
+  g_string_truncate (arena->scratch, 0);
+  return arena->scratch;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_ARENA_H__
+#define __TRANSLIT_ARENA_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define TRANSLIT_TYPE_ARENA (translit_arena_get_type())
+
+typedef struct _TranslitArena TranslitArena;
+
+GType                 translit_arena_get_type
+                      (void) G_GNUC_CONST;
+TranslitArena        *translit_arena_new
+                      (gsize                 chunk_size);
+TranslitArena        *translit_arena_ref
+                      (TranslitArena        *arena);
+void                  translit_arena_unref
+                      (TranslitArena        *arena);
+gpointer              translit_arena_alloc
+                      (TranslitArena        *arena,
+                       gsize                 size);
+gchar                *translit_arena_strndup
+                      (TranslitArena        *arena,
+                       const gchar          *str,
+                       gsize                 len);
+void                  translit_arena_reset
+                      (TranslitArena        *arena);
+gsize                 translit_arena_get_size
+                      (TranslitArena        *arena);
+
+/* for backends */
+GString              *translit_arena_get_scratch
+                      (TranslitArena        *arena);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_ARENA_H__ */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "translitprivate.h"
+#include <string.h>
+
+/* The number of shards, each of which has its own lock.  Must be a
+ * power of 2.  The limits apply to the whole cache, whose size is
+ * counted atomically across the shards.  */
+#define N_SHARDS 16
+
+typedef struct _TranslitCacheEntry TranslitCacheEntry;
+
+struct _TranslitCacheEntry
+{
+  /* link in the LRU list of the shard; DATA points to the entry */
+  GList link;
+
+  guint hash;
+  const gchar *input;
+  gsize input_len;
+  gsize output_len;
+  guint endpos;
+
+  /* the input followed by the output; INPUT points here, except in
+   * the keys used for lookup */
+  gchar data[1];
+};
+
+typedef struct _TranslitCacheShard TranslitCacheShard;
+
+struct _TranslitCacheShard
+{
+  GMutex mutex;
+
+  GHashTable *entries;
+
+  /* most recently used first */
+  GQueue lru;
+
+  guint64 hits;
+  guint64 misses;
+};
+
+struct _TranslitCache
+{
+  guint max_entries;
+  gsize max_bytes;
+
+  /* the size of all the shards, updated atomically */
+  volatile gint n_entries;
+  volatile gsize n_bytes;
+
+  TranslitCacheShard shards[N_SHARDS];
+};
+
+/* FNV-1a, over a string which is not nul-terminated.  */
+static guint
+hash_bytes (const gchar *data, gsize len)
+{
+  guint32 hash = 2166136261U;
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash ^= (guchar) data[i];
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+static guint
+entry_hash (gconstpointer key)
+{
+  return ((const TranslitCacheEntry *) key)->hash;
+}
+
+static gboolean
+entry_equal (gconstpointer a, gconstpointer b)
+{
+  const TranslitCacheEntry *ea = a, *eb = b;
+
+  return ea->hash == eb->hash
+    && ea->input_len == eb->input_len
+    && memcmp (ea->input, eb->input, ea->input_len) == 0;
+}
+
+static gsize
+entry_size (TranslitCacheEntry *entry)
+{
+  return sizeof (TranslitCacheEntry) + entry->input_len + entry->output_len;
+}
+
+TranslitCache *
+_translit_cache_new (guint max_entries,
+		     gsize max_bytes)
+{
+  TranslitCache *cache;
+  gint i;
+
+  cache = g_slice_new0 (TranslitCache);
+  cache->max_entries = MIN (max_entries, G_MAXINT);
+  cache->max_bytes = max_bytes;
+
+  for (i = 0; i < N_SHARDS; i++)
+    {
+      TranslitCacheShard *shard = &cache->shards[i];
+
+      g_mutex_init (&shard->mutex);
+      shard->entries = g_hash_table_new (entry_hash, entry_equal);
+      g_queue_init (&shard->lru);
+    }
+
+  return cache;
+}
+
+void
+_translit_cache_free (TranslitCache *cache)
+{
+  gint i;
+
+  for (i = 0; i < N_SHARDS; i++)
+    {
+      TranslitCacheShard *shard = &cache->shards[i];
+      GList *l, *next;
+
+      for (l = shard->lru.head; l; l = next)
+	{
+	  next = l->next;
+	  g_free (l->data);
+	}
+      g_hash_table_destroy (shard->entries);
+      g_mutex_clear (&shard->mutex);
+    }
+
+  g_slice_free (TranslitCache, cache);
+}
+
+static TranslitCacheShard *
+get_shard (TranslitCache *cache, guint hash)
+{
+  /* The low bits are used by GHashTable; take the high bits.  */
+  return &cache->shards[(hash >> 28) & (N_SHARDS - 1)];
+}
+
+/* Look up INPUT in CACHE and, if found, append the cached output to
+ * OUTPUT.  */
+gboolean
+_translit_cache_lookup (TranslitCache *cache,
+			const gchar   *input,
+			gsize          len,
+			GString       *output,
+			guint         *endpos)
+{
+  TranslitCacheShard *shard;
+  TranslitCacheEntry key, *entry;
+
+  key.hash = hash_bytes (input, len);
+  key.input = input;
+  key.input_len = len;
+
+  shard = get_shard (cache, key.hash);
+
+  g_mutex_lock (&shard->mutex);
+  entry = g_hash_table_lookup (shard->entries, &key);
+  if (entry == NULL)
+    {
+      shard->misses++;
+      g_mutex_unlock (&shard->mutex);
+      return FALSE;
+    }
+
+  shard->hits++;
+  g_queue_unlink (&shard->lru, &entry->link);
+  g_queue_push_head_link (&shard->lru, &entry->link);
+
+  g_string_append_len (output, entry->data + entry->input_len,
+		       entry->output_len);
+  if (endpos)
+    *endpos = entry->endpos;
+  g_mutex_unlock (&shard->mutex);
+
+  return TRUE;
+}
+
+static void
+shard_remove (TranslitCache      *cache,
+	      TranslitCacheShard *shard,
+	      TranslitCacheEntry *entry)
+{
+  g_hash_table_remove (shard->entries, entry);
+  g_queue_unlink (&shard->lru, &entry->link);
+  g_atomic_int_add (&cache->n_entries, -1);
+  g_atomic_pointer_add (&cache->n_bytes, -(gssize) entry_size (entry));
+  g_free (entry);
+}
+
+static gboolean
+is_full (TranslitCache *cache)
+{
+  return (guint) g_atomic_int_get (&cache->n_entries) > cache->max_entries
+    || (cache->max_bytes > 0
+	&& (gsize) g_atomic_pointer_get (&cache->n_bytes) > cache->max_bytes);
+}
+
+/* Evict the least recently used entries of each shard in turn,
+ * starting with SHARD, which ENTRY was just added to, until CACHE is
+ * within its limits.  ENTRY itself is kept, unless another thread
+ * evicts it meanwhile, so it is only compared, not dereferenced.
+ * Only one shard is locked at a time.  */
+static void
+evict (TranslitCache      *cache,
+       TranslitCacheShard *shard,
+       TranslitCacheEntry *entry)
+{
+  guint index = shard - cache->shards, i;
+
+  for (i = 0; i < N_SHARDS && is_full (cache); i++)
+    {
+      shard = &cache->shards[(index + i) & (N_SHARDS - 1)];
+
+      g_mutex_lock (&shard->mutex);
+      while (shard->lru.tail != NULL
+	     && shard->lru.tail->data != entry
+	     && is_full (cache))
+	shard_remove (cache, shard, shard->lru.tail->data);
+      g_mutex_unlock (&shard->mutex);
+    }
+}
+
+/* Store the transliteration of INPUT in CACHE, evicting the least
+ * recently used entries if it is full.  */
+void
+_translit_cache_insert (TranslitCache *cache,
+			const gchar   *input,
+			gsize          len,
+			const gchar   *output,
+			gsize          output_len,
+			guint          endpos)
+{
+  TranslitCacheShard *shard;
+  TranslitCacheEntry *entry, *old;
+  gsize size;
+
+  size = sizeof (TranslitCacheEntry) + len + output_len;
+  if (cache->max_bytes > 0 && size > cache->max_bytes)
+    return;
+
+  entry = g_malloc (size);
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+  entry->hash = hash_bytes (input, len);
+  entry->input = entry->data;
+  entry->input_len = len;
+  entry->output_len = output_len;
+  entry->endpos = endpos;
+  memcpy (entry->data, input, len);
+  memcpy (entry->data + len, output, output_len);
+
+  shard = get_shard (cache, entry->hash);
+
+  g_mutex_lock (&shard->mutex);
+
+  /* Another thread may have stored the same input meanwhile.  */
+  old = g_hash_table_lookup (shard->entries, entry);
+  if (old)
+    shard_remove (cache, shard, old);
+
+  g_hash_table_add (shard->entries, entry);
+  g_queue_push_head_link (&shard->lru, &entry->link);
+  g_atomic_int_inc (&cache->n_entries);
+  g_atomic_pointer_add (&cache->n_bytes, size);
+
+  g_mutex_unlock (&shard->mutex);
+
+  evict (cache, shard, entry);
+}
+
+void
+_translit_cache_get_stats (TranslitCache *cache,
+			   guint64       *hits,
+			   guint64       *misses)
+{
+  gint i;
+
+  *hits = *misses = 0;
+  for (i = 0; i < N_SHARDS; i++)
+    {
+      TranslitCacheShard *shard = &cache->shards[i];
+
+      g_mutex_lock (&shard->mutex);
+      *hits += shard->hits;
+      *misses += shard->misses;
+      g_mutex_unlock (&shard->mutex);
+    }
+}
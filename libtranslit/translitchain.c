@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <gio/gio.h>
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+#include <string.h>
+
+/* The "chain" backend, whose names are lists of transliterators
+ * separated by '|', such as "m17n:hi-inscript|icu:Devanagari-Latin".
+ * Each stage is given the output of the previous one, which is kept
+ * in two buffers used in turn, and the last one appends to the output
+ * of the caller.  Consecutive ICU stages are joined into a single
+ * compound ICU transliterator, so that the text is not converted from
+ * and to UTF-16 between them.  Each chain has its own clones of the
+ * stages, and calls to the same chain from several threads are
+ * serialized, since they share them.  */
+
+#define TYPE_TRANSLITERATOR_CHAIN (transliterator_chain_get_type())
+#define TRANSLITERATOR_CHAIN(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_TRANSLITERATOR_CHAIN, TransliteratorChain))
+
+struct _TransliteratorChain
+{
+  TranslitTransliterator parent;
+
+  TranslitTransliterator **stages;
+  guint n_stages;
+
+  /* Held during each call, so that the stages and the intermediate
+   * buffers reused across calls are used by one thread at a time.  */
+  GMutex mutex;
+  GString *buffers[2];
+};
+
+struct _TransliteratorChainClass
+{
+  TranslitTransliteratorClass parent_class;
+};
+
+typedef struct _TransliteratorChain TransliteratorChain;
+typedef struct _TransliteratorChainClass TransliteratorChainClass;
+
+static void initable_iface_init (GInitableIface *initable_iface);
+
+G_DEFINE_TYPE_WITH_CODE (TransliteratorChain,
+			 transliterator_chain,
+			 TRANSLIT_TYPE_TRANSLITERATOR,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+						initable_iface_init));
+
+static gboolean
+transliterate_stage (TranslitTransliterator *stage,
+		     const gchar            *input,
+		     gsize                   len,
+		     gssize                  n_chars,
+		     GString                *output,
+		     guint                  *endpos,
+		     GError                **error)
+{
+  TranslitTransliteratorClass *klass = TRANSLIT_TRANSLITERATOR_GET_CLASS (stage);
+
+  /* The input has been validated by the caller, or produced by the
+   * previous stage, so call the backend directly.  */
+  return klass->transliterate_full (stage, input, len, n_chars,
+				    output, endpos, NULL, error);
+}
+
+/* The ending position is that of the first stage: the later ones are
+ * given the whole output of the previous stage, and the part of it
+ * which they leave pending can't be traced back to the input.  */
+static gboolean
+transliterate_chain (TransliteratorChain *chain,
+		     const gchar         *input,
+		     gsize                len,
+		     gssize               n_chars,
+		     GString             *output,
+		     guint               *endpos,
+		     GError             **error)
+{
+  const gchar *text = input;
+  gsize text_len = len;
+  gboolean retval = TRUE;
+  guint i;
+
+  g_mutex_lock (&chain->mutex);
+  for (i = 0; i < chain->n_stages; i++)
+    {
+      GString *target;
+
+      if (i == chain->n_stages - 1)
+	target = output;
+      else
+	{
+	  target = chain->buffers[i % 2];
+	  g_string_truncate (target, 0);
+	}
+
+      if (!transliterate_stage (chain->stages[i], text, text_len,
+				i == 0 ? n_chars : -1,
+				target, i == 0 ? endpos : NULL,
+				error))
+	{
+	  retval = FALSE;
+	  break;
+	}
+
+      text = target->str;
+      text_len = target->len;
+    }
+
+  g_mutex_unlock (&chain->mutex);
+
+  return retval;
+}
+
+static gboolean
+transliterator_chain_real_transliterate_full (TranslitTransliterator *self,
+					      const gchar            *input,
+					      gsize                   len,
+					      gssize                  n_chars,
+					      GString                *output,
+					      guint                  *endpos,
+					      TranslitResult         *result,
+					      GError                **error)
+{
+  gsize offset = output->len;
+  guint n;
+
+  if (result == NULL)
+    return transliterate_chain (TRANSLITERATOR_CHAIN (self),
+				input, len, n_chars, output, endpos, error);
+
+  if (!transliterate_chain (TRANSLITERATOR_CHAIN (self),
+			    input, len, n_chars, output, &n, error))
+    return FALSE;
+
+  if (endpos)
+    *endpos = n;
+
+  /* The outputs of the stages can't be aligned with each other, so
+   * the whole input maps to the whole output.  */
+  _translit_result_set_whole (result, input, len, n, output->len - offset);
+
+  return TRUE;
+}
+
+static TranslitTransliterator *
+transliterator_chain_real_clone (TranslitTransliterator *self,
+				 GError                **error)
+{
+  TransliteratorChain *chain = TRANSLITERATOR_CHAIN (self), *clone;
+  gchar *name;
+  guint i;
+
+  /* The stages are cloned as well, so that the clone does not share
+   * any state with SELF.  */
+  g_object_get (G_OBJECT (self), "name", &name, NULL);
+  clone = g_object_new (TYPE_TRANSLITERATOR_CHAIN, "name", name, NULL);
+  g_free (name);
+
+  clone->stages = g_new0 (TranslitTransliterator *, chain->n_stages);
+  clone->n_stages = chain->n_stages;
+  for (i = 0; i < chain->n_stages; i++)
+    {
+      clone->stages[i] = translit_transliterator_clone (chain->stages[i],
+							 error);
+      if (clone->stages[i] == NULL)
+	{
+	  g_object_unref (clone);
+	  return NULL;
+	}
+    }
+
+  return TRANSLIT_TRANSLITERATOR (clone);
+}
+
+static gboolean
+transliterator_chain_real_would_change (TranslitTransliterator *self,
+					const gchar            *input,
+					gsize                   len)
+{
+  TransliteratorChain *chain = TRANSLITERATOR_CHAIN (self);
+  guint i;
+
+  /* As long as a stage leaves the input unchanged, the next one is
+   * given the same input.  */
+  for (i = 0; i < chain->n_stages; i++)
+    {
+      TranslitTransliteratorClass *klass =
+	TRANSLIT_TRANSLITERATOR_GET_CLASS (chain->stages[i]);
+
+      if (klass->would_change (chain->stages[i], input, len))
+	return TRUE;
+    }
+  return FALSE;
+}
+
+static TranslitTransliteratorFlags
+transliterator_chain_real_get_flags (TranslitTransliterator *self)
+{
+  TransliteratorChain *chain = TRANSLITERATOR_CHAIN (self);
+  TranslitTransliteratorFlags flags =
+    TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS;
+  guint i;
+
+  for (i = 0; i < chain->n_stages; i++)
+    {
+      TranslitTransliteratorFlags stage_flags =
+	translit_transliterator_get_flags (chain->stages[i]);
+
+      flags |= stage_flags & (TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE
+			      | TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE);
+      if (!(stage_flags & TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS))
+	flags &= ~TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS;
+    }
+
+  return flags;
+}
+
+static void
+transliterator_chain_finalize (GObject *object)
+{
+  TransliteratorChain *chain = TRANSLITERATOR_CHAIN (object);
+  guint i;
+
+  for (i = 0; i < chain->n_stages; i++)
+    if (chain->stages[i])
+      g_object_unref (chain->stages[i]);
+  g_free (chain->stages);
+  g_string_free (chain->buffers[0], TRUE);
+  g_string_free (chain->buffers[1], TRUE);
+  g_mutex_clear (&chain->mutex);
+
+  G_OBJECT_CLASS (transliterator_chain_parent_class)->finalize (object);
+}
+
+static void
+transliterator_chain_class_init (TransliteratorChainClass *klass)
+{
+  TranslitTransliteratorClass *transliterator_class = TRANSLIT_TRANSLITERATOR_CLASS (klass);
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  transliterator_class->transliterate_full =
+    transliterator_chain_real_transliterate_full;
+  transliterator_class->clone = transliterator_chain_real_clone;
+  transliterator_class->would_change = transliterator_chain_real_would_change;
+  transliterator_class->get_flags = transliterator_chain_real_get_flags;
+
+  gobject_class->finalize = transliterator_chain_finalize;
+}
+
+static void
+transliterator_chain_init (TransliteratorChain *self)
+{
+  g_mutex_init (&self->mutex);
+  self->buffers[0] = g_string_new (NULL);
+  self->buffers[1] = g_string_new (NULL);
+}
+
+static gboolean
+add_stage (GPtrArray   *stages,
+	   const gchar *backend,
+	   const gchar *name,
+	   GError     **error)
+{
+  TranslitTransliterator *stage;
+
+  stage = translit_transliterator_get (backend, name, error);
+  if (stage == NULL)
+    return FALSE;
+
+  /* The instances returned by translit_transliterator_get() are
+   * shared with the other callers, so use a private clone.  */
+  stage = translit_transliterator_clone (stage, error);
+  if (stage == NULL)
+    return FALSE;
+
+  g_ptr_array_add (stages, stage);
+  return TRUE;
+}
+
+static gboolean
+initable_init (GInitable *initable,
+	       GCancellable *cancellable,
+	       GError **error)
+{
+  TransliteratorChain *chain = TRANSLITERATOR_CHAIN (initable);
+  GPtrArray *stages;
+  GString *icu_id;
+  gchar *name, **names;
+  gboolean retval = TRUE;
+  gint i;
+
+  g_object_get (G_OBJECT (initable),
+		"name", &name,
+		NULL);
+
+  names = g_strsplit (name, "|", -1);
+  g_free (name);
+
+  stages = g_ptr_array_new ();
+  icu_id = g_string_new (NULL);
+  for (i = 0; names[i] && retval; i++)
+    {
+      gchar *separator = strchr (names[i], ':');
+
+      if (separator == NULL || separator == names[i]
+	  || *(separator + 1) == '\0')
+	{
+	  g_set_error (error,
+		       TRANSLIT_ERROR,
+		       TRANSLIT_ERROR_LOAD_FAILED,
+		       "invalid chain stage \"%s\"",
+		       names[i]);
+	  retval = FALSE;
+	  break;
+	}
+      *separator = '\0';
+
+      /* Collect consecutive ICU stages into a compound ID.  */
+      if (strcmp (names[i], "icu") == 0)
+	{
+	  if (icu_id->len > 0)
+	    g_string_append_c (icu_id, ';');
+	  g_string_append (icu_id, separator + 1);
+	  continue;
+	}
+
+      if (icu_id->len > 0)
+	{
+	  retval = add_stage (stages, "icu", icu_id->str, error);
+	  g_string_truncate (icu_id, 0);
+	  if (!retval)
+	    break;
+	}
+      retval = add_stage (stages, names[i], separator + 1, error);
+    }
+  if (retval && icu_id->len > 0)
+    retval = add_stage (stages, "icu", icu_id->str, error);
+  g_string_free (icu_id, TRUE);
+  g_strfreev (names);
+
+  if (retval && stages->len == 0)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_LOAD_FAILED,
+		   "empty chain");
+      retval = FALSE;
+    }
+
+  if (!retval)
+    {
+      g_ptr_array_foreach (stages, (GFunc) g_object_unref, NULL);
+      g_ptr_array_free (stages, TRUE);
+      return FALSE;
+    }
+
+  chain->n_stages = stages->len;
+  chain->stages = (TranslitTransliterator **) g_ptr_array_free (stages,
+								  FALSE);
+  return TRUE;
+}
+
+static void
+initable_iface_init (GInitableIface *initable_iface)
+{
+  initable_iface->init = initable_init;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <gio/gio.h>
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+#include <string.h>
+
+/* The maximum number of input bytes buffered before they are handed
+ * to the transliterator, even if no safe boundary has been found.  */
+#define MAX_CHUNK_SIZE (64 * 1024)
+
+enum
+  {
+    PROP_0,
+    PROP_TRANSLITERATOR
+  };
+
+static void converter_iface_init (GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (TranslitConverter, translit_converter, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						converter_iface_init));
+
+#define TRANSLIT_CONVERTER_GET_PRIVATE(obj)				\
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), TRANSLIT_TYPE_CONVERTER, TranslitConverterPrivate))
+
+struct _TranslitConverterPrivate
+{
+  TranslitTransliterator *transliterator;
+
+  /* input which has not been transliterated yet */
+  GString *pending;
+
+  /* transliterated output which has not been returned yet */
+  GString *output;
+  gsize output_pos;
+};
+
+static GConverterResult
+translit_converter_convert (GConverter *converter,
+			    const void *inbuf,
+			    gsize       inbuf_size,
+			    void       *outbuf,
+			    gsize       outbuf_size,
+			    GConverterFlags flags,
+			    gsize      *bytes_read,
+			    gsize      *bytes_written,
+			    GError    **error)
+{
+  TranslitConverterPrivate *priv = TRANSLIT_CONVERTER (converter)->priv;
+  gsize n_read = 0, n_written;
+
+  if (priv->pending->len < MAX_CHUNK_SIZE)
+    {
+      n_read = MIN (inbuf_size, MAX_CHUNK_SIZE - priv->pending->len);
+      g_string_append_len (priv->pending, inbuf, n_read);
+    }
+
+  if (priv->output_pos == priv->output->len)
+    {
+      gsize length;
+
+      g_string_truncate (priv->output, 0);
+      priv->output_pos = 0;
+
+      if ((flags & (G_CONVERTER_INPUT_AT_END | G_CONVERTER_FLUSH)) != 0
+	  && n_read == inbuf_size)
+	length = priv->pending->len;
+      else
+	{
+	  length = _translit_find_boundary (priv->pending->str,
+					    priv->pending->len,
+					    TRANSLIT_SPLIT_WHITESPACE);
+
+	  /* No boundary found in a full chunk; split it before the
+	   * last character, which might be incomplete.  */
+	  if (length == 0 && priv->pending->len >= MAX_CHUNK_SIZE)
+	    {
+	      const gchar *last;
+
+	      last = g_utf8_find_prev_char (priv->pending->str,
+					    priv->pending->str
+					    + priv->pending->len);
+	      if (last)
+		length = last - priv->pending->str;
+	    }
+	}
+
+      if (length > 0)
+	{
+	  if (!translit_transliterator_transliterate_append
+	      (priv->transliterator,
+	       priv->pending->str, length,
+	       priv->output,
+	       NULL,
+	       error))
+	    {
+	      g_string_truncate (priv->pending, priv->pending->len - n_read);
+	      return G_CONVERTER_ERROR;
+	    }
+	  g_string_erase (priv->pending, 0, length);
+	}
+    }
+
+  n_written = MIN (outbuf_size, priv->output->len - priv->output_pos);
+  memcpy (outbuf, priv->output->str + priv->output_pos, n_written);
+  priv->output_pos += n_written;
+
+  *bytes_read = n_read;
+  *bytes_written = n_written;
+
+  if (n_read == inbuf_size
+      && priv->pending->len == 0
+      && priv->output_pos == priv->output->len)
+    {
+      if (flags & G_CONVERTER_INPUT_AT_END)
+	return G_CONVERTER_FINISHED;
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+    }
+
+  if (n_read == 0 && n_written == 0)
+    {
+      if (priv->output_pos < priv->output->len)
+	g_set_error_literal (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_NO_SPACE,
+			     "not enough space in the output buffer");
+      else
+	g_set_error_literal (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_PARTIAL_INPUT,
+			     "need more input");
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+translit_converter_reset (GConverter *converter)
+{
+  TranslitConverterPrivate *priv = TRANSLIT_CONVERTER (converter)->priv;
+
+  g_string_truncate (priv->pending, 0);
+  g_string_truncate (priv->output, 0);
+  priv->output_pos = 0;
+}
+
+static void
+converter_iface_init (GConverterIface *iface)
+{
+  iface->convert = translit_converter_convert;
+  iface->reset = translit_converter_reset;
+}
+
+static void
+translit_converter_set_property (GObject      *object,
+				 guint         prop_id,
+				 const GValue *value,
+				 GParamSpec   *pspec)
+{
+  TranslitConverter *converter = TRANSLIT_CONVERTER (object);
+
+  switch (prop_id)
+    {
+    case PROP_TRANSLITERATOR:
+      if (converter->priv->transliterator)
+	g_object_unref (converter->priv->transliterator);
+      converter->priv->transliterator = g_value_dup_object (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+translit_converter_get_property (GObject    *object,
+				 guint       prop_id,
+				 GValue     *value,
+				 GParamSpec *pspec)
+{
+  TranslitConverter *converter = TRANSLIT_CONVERTER (object);
+
+  switch (prop_id)
+    {
+    case PROP_TRANSLITERATOR:
+      g_value_set_object (value, converter->priv->transliterator);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+translit_converter_dispose (GObject *object)
+{
+  TranslitConverter *converter = TRANSLIT_CONVERTER (object);
+
+  if (converter->priv->transliterator)
+    {
+      g_object_unref (converter->priv->transliterator);
+      converter->priv->transliterator = NULL;
+    }
+
+  G_OBJECT_CLASS (translit_converter_parent_class)->dispose (object);
+}
+
+static void
+translit_converter_finalize (GObject *object)
+{
+  TranslitConverter *converter = TRANSLIT_CONVERTER (object);
+
+  g_string_free (converter->priv->pending, TRUE);
+  g_string_free (converter->priv->output, TRUE);
+
+  G_OBJECT_CLASS (translit_converter_parent_class)->finalize (object);
+}
+
+static void
+translit_converter_class_init (TranslitConverterClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GParamSpec *pspec;
+
+  object_class->set_property = translit_converter_set_property;
+  object_class->get_property = translit_converter_get_property;
+  object_class->dispose = translit_converter_dispose;
+  object_class->finalize = translit_converter_finalize;
+
+  g_type_class_add_private (object_class,
+			    sizeof (TranslitConverterPrivate));
+
+  /**
+   * TranslitConverter:transliterator:
+   *
+   * The #TranslitTransliterator used to convert the data
+   */
+  pspec = g_param_spec_object ("transliterator",
+			       "transliterator",
+			       "Transliterator",
+			       TRANSLIT_TYPE_TRANSLITERATOR,
+			       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+  g_object_class_install_property (object_class, PROP_TRANSLITERATOR, pspec);
+}
+
+static void
+translit_converter_init (TranslitConverter *self)
+{
+  self->priv = TRANSLIT_CONVERTER_GET_PRIVATE (self);
+  self->priv->pending = g_string_new (NULL);
+  self->priv->output = g_string_new (NULL);
+}
+
+/**
+ * translit_converter_new:
+ * @transliterator: a #TranslitTransliterator
+ *
+ * Create a #GConverter which transliterates UTF-8 data with
+ * @transliterator.  It can be used with #GConverterInputStream or
+ * #GConverterOutputStream to transliterate data of arbitrary size.
+ *
+ * The input is buffered up to a safe boundary (a newline or a
+ * whitespace), where no transliteration context is kept, and each
+ * such chunk is transliterated independently.  A chunk never exceeds
+ * 64 KiB, so memory usage does not depend on the input size.
+ *
+ * Returns: (transfer full): a new #TranslitConverter
+ */
+TranslitConverter *
+translit_converter_new (TranslitTransliterator *transliterator)
+{
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+
+  return g_object_new (TRANSLIT_TYPE_CONVERTER,
+		       "transliterator", transliterator,
+		       NULL);
+}
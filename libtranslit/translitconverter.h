@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_CONVERTER_H__
+#define __TRANSLIT_CONVERTER_H__
+
+#include <gio/gio.h>
+#include <libtranslit/translittransliterator.h>
+
+G_BEGIN_DECLS
+
+#define TRANSLIT_TYPE_CONVERTER (translit_converter_get_type())
+#define TRANSLIT_CONVERTER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TRANSLIT_TYPE_CONVERTER, TranslitConverter))
+#define TRANSLIT_CONVERTER_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TRANSLIT_TYPE_CONVERTER, TranslitConverterClass))
+#define TRANSLIT_IS_CONVERTER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), TRANSLIT_TYPE_CONVERTER))
+#define TRANSLIT_IS_CONVERTER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), TRANSLIT_TYPE_CONVERTER))
+#define TRANSLIT_CONVERTER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), TRANSLIT_TYPE_CONVERTER, TranslitConverterClass))
+
+typedef struct _TranslitConverter TranslitConverter;
+typedef struct _TranslitConverterClass TranslitConverterClass;
+typedef struct _TranslitConverterPrivate TranslitConverterPrivate;
+
+struct _TranslitConverter
+{
+  /*< private >*/
+  GObject parent;
+
+  TranslitConverterPrivate *priv;
+};
+
+struct _TranslitConverterClass
+{
+  /*< private >*/
+  GObjectClass parent_class;
+};
+
+GType              translit_converter_get_type
+                   (void) G_GNUC_CONST;
+TranslitConverter *translit_converter_new
+                   (TranslitTransliterator *transliterator);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_CONVERTER_H__ */
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+
+struct _TranslitPool
+{
+  volatile gint ref_count;
+
+  TranslitTransliterator *prototype;
+  gboolean weak;
+  guint max_size;
+
+  GMutex mutex;
+  GCond cond;
+  GQueue idle;
+  guint n_instances;
+};
+
+G_DEFINE_BOXED_TYPE (TranslitPool, translit_pool,
+		     translit_pool_ref, translit_pool_unref);
+
+/**
+ * translit_pool_new:
+ * @prototype: a #TranslitTransliterator
+ * @max_size: the maximum number of instances, or 0 for no limit
+ *
+ * Create a pool of instances of @prototype, so that each thread can
+ * check out its own instance with translit_pool_acquire().  The
+ * instances are created with translit_transliterator_clone() when
+ * needed and reused after they are released.
+ *
+ * If @prototype has %TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE, its
+ * clones are not independent, and the pool holds a single instance
+ * whatever @max_size is, so that the threads use it in turn.  This
+ * does not serialize them with the other instances of the same
+ * backend used outside of the pool.
+ *
+ * Returns: (transfer full): a new #TranslitPool
+ */
+TranslitPool *
+translit_pool_new (TranslitTransliterator *prototype,
+		   guint                   max_size)
+{
+  TranslitPool *pool;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (prototype), NULL);
+
+  pool = _translit_pool_new_weak (prototype, max_size);
+  pool->prototype = g_object_ref (prototype);
+  pool->weak = FALSE;
+
+  return pool;
+}
+
+/* Create a pool which does not hold a reference to PROTOTYPE, so
+ * that it can be owned by PROTOTYPE itself.  */
+TranslitPool *
+_translit_pool_new_weak (TranslitTransliterator *prototype,
+			 guint                   max_size)
+{
+  TranslitPool *pool;
+
+  pool = g_slice_new0 (TranslitPool);
+  pool->ref_count = 1;
+  pool->prototype = prototype;
+  pool->weak = TRUE;
+  pool->max_size = max_size;
+  if (translit_transliterator_get_flags (prototype)
+      & TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE)
+    pool->max_size = 1;
+  g_mutex_init (&pool->mutex);
+  g_cond_init (&pool->cond);
+  g_queue_init (&pool->idle);
+
+  return pool;
+}
+
+/**
+ * translit_pool_ref:
+ * @pool: a #TranslitPool
+ *
+ * Returns: (transfer full): @pool
+ */
+TranslitPool *
+translit_pool_ref (TranslitPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_atomic_int_inc (&pool->ref_count);
+  return pool;
+}
+
+/**
+ * translit_pool_unref:
+ * @pool: a #TranslitPool
+ *
+ * Decrease the reference count of @pool.  All the instances acquired
+ * from @pool must have been released before the last reference is
+ * dropped.
+ */
+void
+translit_pool_unref (TranslitPool *pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  if (g_atomic_int_dec_and_test (&pool->ref_count))
+    {
+      g_warn_if_fail (g_queue_get_length (&pool->idle) == pool->n_instances);
+
+      g_queue_foreach (&pool->idle, (GFunc) g_object_unref, NULL);
+      g_queue_clear (&pool->idle);
+      if (!pool->weak)
+	g_object_unref (pool->prototype);
+      g_mutex_clear (&pool->mutex);
+      g_cond_clear (&pool->cond);
+      g_slice_free (TranslitPool, pool);
+    }
+}
+
+/**
+ * translit_pool_acquire:
+ * @pool: a #TranslitPool
+ * @error: a #GError
+ *
+ * Check out an instance from @pool.  If all the instances are in use
+ * and the pool has reached its maximum size, this blocks until one
+ * is released; for a backend with
+ * %TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE, this is as soon as
+ * another thread holds the single instance.  The instance must be given back with
+ * translit_pool_release().
+ *
+ * Returns: (transfer full): a #TranslitTransliterator, or %NULL on error
+ */
+TranslitTransliterator *
+translit_pool_acquire (TranslitPool *pool,
+		       GError      **error)
+{
+  TranslitTransliterator *transliterator;
+
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_mutex_lock (&pool->mutex);
+  while (g_queue_is_empty (&pool->idle)
+	 && pool->max_size > 0
+	 && pool->n_instances >= pool->max_size)
+    g_cond_wait (&pool->cond, &pool->mutex);
+
+  transliterator = g_queue_pop_head (&pool->idle);
+  if (transliterator == NULL)
+    pool->n_instances++;
+  g_mutex_unlock (&pool->mutex);
+
+  if (transliterator != NULL)
+    return transliterator;
+
+  /* Clone outside of the lock, since it may take a while.  */
+  transliterator = translit_transliterator_clone (pool->prototype, error);
+  if (transliterator == NULL)
+    {
+      g_mutex_lock (&pool->mutex);
+      pool->n_instances--;
+      g_cond_signal (&pool->cond);
+      g_mutex_unlock (&pool->mutex);
+    }
+
+  return transliterator;
+}
+
+/**
+ * translit_pool_release:
+ * @pool: a #TranslitPool
+ * @transliterator: (transfer full): a #TranslitTransliterator
+ * acquired from @pool
+ *
+ * Give back @transliterator to @pool.
+ */
+void
+translit_pool_release (TranslitPool           *pool,
+		       TranslitTransliterator *transliterator)
+{
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
+
+  g_mutex_lock (&pool->mutex);
+  g_queue_push_head (&pool->idle, transliterator);
+  g_cond_signal (&pool->cond);
+  g_mutex_unlock (&pool->mutex);
+}
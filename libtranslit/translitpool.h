@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_POOL_H__
+#define __TRANSLIT_POOL_H__
+
+#include <glib-object.h>
+#include <libtranslit/translittransliterator.h>
+
+G_BEGIN_DECLS
+
+#define TRANSLIT_TYPE_POOL (translit_pool_get_type())
+
+typedef struct _TranslitPool TranslitPool;
+
+GType                   translit_pool_get_type
+                        (void) G_GNUC_CONST;
+TranslitPool           *translit_pool_new
+                        (TranslitTransliterator *prototype,
+                         guint                   max_size);
+TranslitPool           *translit_pool_ref
+                        (TranslitPool           *pool);
+void                    translit_pool_unref
+                        (TranslitPool           *pool);
+TranslitTransliterator *translit_pool_acquire
+                        (TranslitPool           *pool,
+                         GError                **error);
+void                    translit_pool_release
+                        (TranslitPool           *pool,
+                         TranslitTransliterator *transliterator);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_POOL_H__ */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_PRIVATE_H__
+#define __TRANSLIT_PRIVATE_H__
+
+#include <libtranslit/translit.h>
+#include <time.h>
+
+G_BEGIN_DECLS
+
+/* A monotonic clock, in nanoseconds.  */
+static inline guint64
+_translit_get_time_ns (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#else
+  return (guint64) g_get_monotonic_time () * 1000;
+#endif
+}
+
+gsize         _translit_find_boundary (const gchar            *text,
+                                       gsize                   len,
+                                       TranslitSplitPolicy     policy);
+TranslitPool *_translit_pool_new_weak (TranslitTransliterator *prototype,
+                                       guint                   max_size);
+void          _translit_result_reset  (TranslitResult         *result);
+void          _translit_result_set_whole
+                                      (TranslitResult         *result,
+                                       const gchar            *input,
+                                       gsize                   len,
+                                       guint                   endpos,
+                                       gsize                   output_len);
+gboolean      _translit_utf8_validate_count
+                                      (const gchar            *input,
+                                       gssize                  len,
+                                       gsize                  *byte_len,
+                                       gsize                  *n_chars);
+
+/* the type of the "chain" backend */
+GType         transliterator_chain_get_type
+                                      (void) G_GNUC_CONST;
+
+extern volatile gint _translit_trace_enabled;
+
+void          _translit_trace_init    (void);
+
+/* Record a span, with only a load and a branch when tracing is
+ * disabled.  */
+#define TRANSLIT_TRACE_BEGIN(name)				\
+  G_STMT_START {						\
+    if (G_UNLIKELY (_translit_trace_enabled))			\
+      translit_trace_begin (name);				\
+  } G_STMT_END
+#define TRANSLIT_TRACE_END()					\
+  G_STMT_START {						\
+    if (G_UNLIKELY (_translit_trace_enabled))			\
+      translit_trace_end ();					\
+  } G_STMT_END
+
+typedef struct _TranslitCache TranslitCache;
+
+TranslitCache *_translit_cache_new       (guint          max_entries,
+                                          gsize          max_bytes);
+void           _translit_cache_free      (TranslitCache *cache);
+gboolean       _translit_cache_lookup    (TranslitCache *cache,
+                                          const gchar   *input,
+                                          gsize          len,
+                                          GString       *output,
+                                          guint         *endpos);
+void           _translit_cache_insert    (TranslitCache *cache,
+                                          const gchar   *input,
+                                          gsize          len,
+                                          const gchar   *output,
+                                          gsize          output_len,
+                                          guint          endpos);
+void           _translit_cache_get_stats (TranslitCache *cache,
+                                          guint64       *hits,
+                                          guint64       *misses);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_PRIVATE_H__ */
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+
+/**
+ * SECTION:translitresult
+ * @short_description: details of a transliteration
+ *
+ * A #TranslitResult is filled by
+ * translit_transliterator_transliterate_full() with the ending
+ * position of the transliteration, both in characters and in bytes,
+ * and, if requested with %TRANSLIT_RESULT_ALIGNMENT, with a table
+ * mapping spans of the input to the spans of the output they turned
+ * into.  The table is as fine as the backend can tell: the table
+ * backend records each key, m17n each commit, while ICU only maps
+ * the whole input to the whole output.
+ */
+
+struct _TranslitResult
+{
+  volatile gint ref_count;
+
+  TranslitResultFlags flags;
+  guint endpos;
+  gsize end_offset;
+
+  /* TranslitAlignmentRun, or NULL without TRANSLIT_RESULT_ALIGNMENT */
+  GArray *runs;
+};
+
+G_DEFINE_BOXED_TYPE (TranslitResult, translit_result,
+		     translit_result_ref, translit_result_unref);
+
+/**
+ * translit_result_new:
+ * @flags: what to record
+ *
+ * Create a #TranslitResult to pass to
+ * translit_transliterator_transliterate_full().  It can be reused
+ * across calls, which saves the allocation of the alignment table.
+ *
+ * Returns: (transfer full): a new #TranslitResult
+ */
+TranslitResult *
+translit_result_new (TranslitResultFlags flags)
+{
+  TranslitResult *result;
+
+  result = g_slice_new0 (TranslitResult);
+  result->ref_count = 1;
+  result->flags = flags;
+  if (flags & TRANSLIT_RESULT_ALIGNMENT)
+    result->runs = g_array_new (FALSE, FALSE, sizeof (TranslitAlignmentRun));
+
+  return result;
+}
+
+/**
+ * translit_result_ref:
+ * @result: a #TranslitResult
+ *
+ * Returns: (transfer full): @result
+ */
+TranslitResult *
+translit_result_ref (TranslitResult *result)
+{
+  g_return_val_if_fail (result != NULL, NULL);
+
+  g_atomic_int_inc (&result->ref_count);
+  return result;
+}
+
+/**
+ * translit_result_unref:
+ * @result: a #TranslitResult
+ *
+ * Decrease the reference count of @result.
+ */
+void
+translit_result_unref (TranslitResult *result)
+{
+  g_return_if_fail (result != NULL);
+
+  if (g_atomic_int_dec_and_test (&result->ref_count))
+    {
+      if (result->runs)
+	g_array_free (result->runs, TRUE);
+      g_slice_free (TranslitResult, result);
+    }
+}
+
+/* Clear RESULT before it is filled again.  */
+void
+_translit_result_reset (TranslitResult *result)
+{
+  result->endpos = 0;
+  result->end_offset = 0;
+  if (result->runs)
+    g_array_set_size (result->runs, 0);
+}
+
+/* Record that ENDPOS characters of INPUT were consumed, and that the
+ * whole of INPUT maps to the whole output of OUTPUT_LEN bytes, for
+ * the backends which can't tell more.  */
+void
+_translit_result_set_whole (TranslitResult *result,
+			    const gchar    *input,
+			    gsize           len,
+			    guint           endpos,
+			    gsize           output_len)
+{
+  const gchar *p, *end = input + len;
+  guint i;
+
+  for (p = input, i = 0; i < endpos && p < end; i++)
+    p = g_utf8_next_char (p);
+  translit_result_set_end (result, endpos, p - input);
+  translit_result_add_run (result, len, output_len);
+}
+
+/**
+ * translit_result_get_endpos:
+ * @result: a #TranslitResult
+ *
+ * Returns: the ending position of the transliteration, as the
+ * @endpos of translit_transliterator_transliterate()
+ */
+guint
+translit_result_get_endpos (TranslitResult *result)
+{
+  g_return_val_if_fail (result != NULL, 0);
+
+  return result->endpos;
+}
+
+/**
+ * translit_result_get_end_offset:
+ * @result: a #TranslitResult
+ *
+ * Returns: the ending position of the transliteration in bytes, that
+ * is, the length of the part of the input which has been fully
+ * transliterated
+ */
+gsize
+translit_result_get_end_offset (TranslitResult *result)
+{
+  g_return_val_if_fail (result != NULL, 0);
+
+  return result->end_offset;
+}
+
+/**
+ * translit_result_get_runs:
+ * @result: a #TranslitResult
+ * @n_runs: (out): return location for the number of runs
+ *
+ * Get the alignment table of @result.  The input spans cover the
+ * whole input, and the output spans the whole output, in order; the
+ * output offsets are relative to where the output was appended.
+ *
+ * Returns: (array length=n_runs) (transfer none): the alignment
+ * table, or %NULL if @result was created without
+ * %TRANSLIT_RESULT_ALIGNMENT
+ */
+const TranslitAlignmentRun *
+translit_result_get_runs (TranslitResult *result,
+			  guint          *n_runs)
+{
+  g_return_val_if_fail (result != NULL, NULL);
+  g_return_val_if_fail (n_runs != NULL, NULL);
+
+  if (result->runs == NULL)
+    {
+      *n_runs = 0;
+      return NULL;
+    }
+
+  *n_runs = result->runs->len;
+  return (const TranslitAlignmentRun *) result->runs->data;
+}
+
+/**
+ * translit_result_map_output_span:
+ * @result: a #TranslitResult
+ * @output_start: the start of a span of the output in bytes
+ * @output_end: the end of the span
+ * @input_start: (out) (allow-none): return location for the start of
+ * the corresponding span of the input
+ * @input_end: (out) (allow-none): return location for the end of the
+ * corresponding span of the input
+ *
+ * Find the smallest span of the input which produced the output
+ * between @output_start and @output_end, for example to highlight a
+ * match found in the output.
+ *
+ * Returns: %TRUE if the span was found, %FALSE if it is out of the
+ * output or @result has no alignment table
+ */
+gboolean
+translit_result_map_output_span (TranslitResult *result,
+				 gsize           output_start,
+				 gsize           output_end,
+				 gsize          *input_start,
+				 gsize          *input_end)
+{
+  gsize in = 0, out = 0, start = 0;
+  gboolean found = FALSE;
+  guint i;
+
+  g_return_val_if_fail (result != NULL, FALSE);
+  g_return_val_if_fail (output_start <= output_end, FALSE);
+
+  if (result->runs == NULL)
+    return FALSE;
+
+  for (i = 0; i < result->runs->len; i++)
+    {
+      TranslitAlignmentRun *run = &g_array_index (result->runs,
+						  TranslitAlignmentRun, i);
+      gsize next_in = in + run->input_length;
+      gsize next_out = out + run->output_length;
+
+      /* An empty span maps to the run which contains its position.  */
+      if (!found
+	  && (output_start < next_out
+	      || (output_start == output_end && output_start == next_out
+		  && i == result->runs->len - 1)))
+	{
+	  start = in;
+	  found = TRUE;
+	}
+
+      if (found && output_end <= next_out)
+	{
+	  if (input_start)
+	    *input_start = start;
+	  if (input_end)
+	    *input_end = next_in;
+	  return TRUE;
+	}
+
+      in = next_in;
+      out = next_out;
+    }
+
+  return FALSE;
+}
+
+/**
+ * translit_result_set_end:
+ * @result: a #TranslitResult
+ * @endpos: the ending position of the transliteration, as the @endpos
+ * of translit_transliterator_transliterate()
+ * @end_offset: the ending position in bytes
+ *
+ * Set the ending position of the transliteration.  Backends call this
+ * from their transliterate_full implementation.
+ */
+void
+translit_result_set_end (TranslitResult *result,
+			 guint           endpos,
+			 gsize           end_offset)
+{
+  g_return_if_fail (result != NULL);
+
+  result->endpos = endpos;
+  result->end_offset = end_offset;
+}
+
+/**
+ * translit_result_add_run:
+ * @result: a #TranslitResult
+ * @input_length: the length in bytes of the next span of the input
+ * @output_length: the length in bytes of the output it turned into
+ *
+ * Append a run to the alignment table of @result, if it has one.
+ * Backends call this from their transliterate_full implementation.
+ */
+void
+translit_result_add_run (TranslitResult *result,
+			 gsize           input_length,
+			 gsize           output_length)
+{
+  TranslitAlignmentRun run;
+
+  if (result == NULL || result->runs == NULL)
+    return;
+
+  if (input_length == 0 && output_length == 0)
+    return;
+
+  /* Split the spans which don't fit in a run.  */
+  while (input_length > G_MAXUINT32 || output_length > G_MAXUINT32)
+    {
+      run.input_length = MIN (input_length, G_MAXUINT32);
+      run.output_length = MIN (output_length, G_MAXUINT32);
+      g_array_append_val (result->runs, run);
+      input_length -= run.input_length;
+      output_length -= run.output_length;
+    }
+
+  run.input_length = input_length;
+  run.output_length = output_length;
+  g_array_append_val (result->runs, run);
+}
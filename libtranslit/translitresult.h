@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_RESULT_H__
+#define __TRANSLIT_RESULT_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define TRANSLIT_TYPE_RESULT (translit_result_get_type())
+
+typedef struct _TranslitResult TranslitResult;
+
+/**
+ * TranslitResultFlags:
+ * @TRANSLIT_RESULT_FLAGS_NONE: no flags
+ * @TRANSLIT_RESULT_ALIGNMENT: record which part of the input each
+ * part of the output comes from
+ *
+ * What is recorded in a #TranslitResult.
+ */
+typedef enum {
+  TRANSLIT_RESULT_FLAGS_NONE = 0,
+  TRANSLIT_RESULT_ALIGNMENT = 1 << 0
+} TranslitResultFlags;
+
+typedef struct _TranslitAlignmentRun TranslitAlignmentRun;
+
+/**
+ * TranslitAlignmentRun:
+ * @input_length: the length of the input span in bytes
+ * @output_length: the length of the output span in bytes
+ *
+ * An entry of the alignment table of a #TranslitResult.  The spans
+ * of consecutive runs are adjacent, so the offset of a span is the
+ * sum of the lengths of the spans before it.
+ */
+struct _TranslitAlignmentRun
+{
+  guint32 input_length;
+  guint32 output_length;
+};
+
+GType                 translit_result_get_type
+                      (void) G_GNUC_CONST;
+TranslitResult       *translit_result_new
+                      (TranslitResultFlags   flags);
+TranslitResult       *translit_result_ref
+                      (TranslitResult       *result);
+void                  translit_result_unref
+                      (TranslitResult       *result);
+guint                 translit_result_get_endpos
+                      (TranslitResult       *result);
+gsize                 translit_result_get_end_offset
+                      (TranslitResult       *result);
+const TranslitAlignmentRun *
+                      translit_result_get_runs
+                      (TranslitResult       *result,
+                       guint                *n_runs);
+gboolean              translit_result_map_output_span
+                      (TranslitResult       *result,
+                       gsize                 output_start,
+                       gsize                 output_end,
+                       gsize                *input_start,
+                       gsize                *input_end);
+
+/* for backends */
+void                  translit_result_set_end
+                      (TranslitResult       *result,
+                       guint                 endpos,
+                       gsize                 end_offset);
+void                  translit_result_add_run
+                      (TranslitResult       *result,
+                       gsize                 input_length,
+                       gsize                 output_length);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_RESULT_H__ */
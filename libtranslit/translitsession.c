@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include "translitprivate.h"
+#include <string.h>
+
+enum
+  {
+    PROP_0,
+    PROP_TRANSLITERATOR
+  };
+
+G_DEFINE_TYPE (TranslitSession, translit_session, G_TYPE_OBJECT);
+
+#define TRANSLIT_SESSION_GET_PRIVATE(obj)				\
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), TRANSLIT_TYPE_SESSION, TranslitSessionPrivate))
+
+struct _TranslitSessionPrivate
+{
+  TranslitTransliterator *transliterator;
+
+  /* Used by the default implementation, which has no way to resume
+   * the backend state and thus keeps the input after the last safe
+   * boundary.  */
+  GString *input;
+  GString *pending;
+};
+
+/* The length of the buffered input beyond which it is split even
+ * where no boundary was found, so that text without whitespace, such
+ * as CJK, is not transliterated again in full on each append.  */
+#define MAX_BUFFERED_INPUT 1024
+
+/* Return the length of a prefix of TEXT to commit when it has grown
+ * too long: up to the last punctuation in its second half if any,
+ * such as an ideographic full stop, or else all but the last
+ * character, which is kept as the context of the following input.  */
+static gsize
+find_forced_boundary (const gchar *text,
+		      gsize        len)
+{
+  const gchar *p = text + len;
+
+  while ((p = g_utf8_find_prev_char (text, p)) != NULL
+	 && (gsize) (p - text) >= len / 2)
+    if (g_unichar_ispunct (g_utf8_get_char (p)))
+      return g_utf8_next_char (p) - text;
+
+  p = g_utf8_find_prev_char (text, text + len);
+  return p ? (gsize) (p - text) : 0;
+}
+
+static gboolean
+translit_session_real_append (TranslitSession *self,
+			      const gchar     *input,
+			      gsize            len,
+			      GString         *committed,
+			      GError         **error)
+{
+  TranslitSessionPrivate *priv = self->priv;
+  gsize length;
+
+  g_string_append_len (priv->input, input, len);
+
+  length = _translit_find_boundary (priv->input->str,
+				    priv->input->len,
+				    TRANSLIT_SPLIT_WHITESPACE);
+  if (priv->input->len - length > MAX_BUFFERED_INPUT)
+    length = MAX (length,
+		  find_forced_boundary (priv->input->str, priv->input->len));
+  if (length > 0)
+    {
+      if (!translit_transliterator_transliterate_append (priv->transliterator,
+							 priv->input->str,
+							 length,
+							 committed,
+							 NULL,
+							 error))
+	{
+	  g_string_truncate (priv->input, priv->input->len - len);
+	  return FALSE;
+	}
+      g_string_erase (priv->input, 0, length);
+    }
+
+  g_string_truncate (priv->pending, 0);
+  return translit_transliterator_transliterate_append (priv->transliterator,
+						       priv->input->str,
+						       priv->input->len,
+						       priv->pending,
+						       NULL,
+						       error);
+}
+
+static gboolean
+translit_session_real_finish (TranslitSession *self,
+			      GString         *committed,
+			      GError         **error)
+{
+  TranslitSessionPrivate *priv = self->priv;
+
+  g_string_append_len (committed, priv->pending->str, priv->pending->len);
+  g_string_truncate (priv->input, 0);
+  g_string_truncate (priv->pending, 0);
+
+  return TRUE;
+}
+
+static void
+translit_session_real_reset (TranslitSession *self)
+{
+  g_string_truncate (self->priv->input, 0);
+  g_string_truncate (self->priv->pending, 0);
+}
+
+static const gchar *
+translit_session_real_get_pending (TranslitSession *self)
+{
+  return self->priv->pending->str;
+}
+
+static void
+translit_session_set_property (GObject      *object,
+			       guint         prop_id,
+			       const GValue *value,
+			       GParamSpec   *pspec)
+{
+  TranslitSession *session = TRANSLIT_SESSION (object);
+
+  switch (prop_id)
+    {
+    case PROP_TRANSLITERATOR:
+      if (session->priv->transliterator)
+	g_object_unref (session->priv->transliterator);
+      session->priv->transliterator = g_value_dup_object (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+translit_session_get_property (GObject    *object,
+			       guint       prop_id,
+			       GValue     *value,
+			       GParamSpec *pspec)
+{
+  TranslitSession *session = TRANSLIT_SESSION (object);
+
+  switch (prop_id)
+    {
+    case PROP_TRANSLITERATOR:
+      g_value_set_object (value, session->priv->transliterator);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+translit_session_dispose (GObject *object)
+{
+  TranslitSession *session = TRANSLIT_SESSION (object);
+
+  if (session->priv->transliterator)
+    {
+      g_object_unref (session->priv->transliterator);
+      session->priv->transliterator = NULL;
+    }
+
+  G_OBJECT_CLASS (translit_session_parent_class)->dispose (object);
+}
+
+static void
+translit_session_finalize (GObject *object)
+{
+  TranslitSession *session = TRANSLIT_SESSION (object);
+
+  g_string_free (session->priv->input, TRUE);
+  g_string_free (session->priv->pending, TRUE);
+
+  G_OBJECT_CLASS (translit_session_parent_class)->finalize (object);
+}
+
+static void
+translit_session_class_init (TranslitSessionClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GParamSpec *pspec;
+
+  klass->append = translit_session_real_append;
+  klass->finish = translit_session_real_finish;
+  klass->reset = translit_session_real_reset;
+  klass->get_pending = translit_session_real_get_pending;
+
+  object_class->set_property = translit_session_set_property;
+  object_class->get_property = translit_session_get_property;
+  object_class->dispose = translit_session_dispose;
+  object_class->finalize = translit_session_finalize;
+
+  g_type_class_add_private (object_class,
+			    sizeof (TranslitSessionPrivate));
+
+  /**
+   * TranslitSession:transliterator:
+   *
+   * The #TranslitTransliterator which this session feeds
+   */
+  pspec = g_param_spec_object ("transliterator",
+			       "transliterator",
+			       "Transliterator",
+			       TRANSLIT_TYPE_TRANSLITERATOR,
+			       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+  g_object_class_install_property (object_class, PROP_TRANSLITERATOR, pspec);
+}
+
+static void
+translit_session_init (TranslitSession *self)
+{
+  self->priv = TRANSLIT_SESSION_GET_PRIVATE (self);
+  self->priv->input = g_string_new (NULL);
+  self->priv->pending = g_string_new (NULL);
+}
+
+/**
+ * translit_session_new:
+ * @transliterator: a #TranslitTransliterator
+ *
+ * Create a new incremental transliteration session.  Unlike
+ * translit_transliterator_transliterate(), which reprocesses the
+ * whole input on every call, a session keeps the backend state
+ * between calls to translit_session_append(), so that the cost of
+ * each call only depends on the length of the appended input.
+ *
+ * Returns: (transfer full): a new #TranslitSession
+ */
+TranslitSession *
+translit_session_new (TranslitTransliterator *transliterator)
+{
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+
+  return TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
+    create_session (transliterator);
+}
+
+/**
+ * translit_session_get_transliterator:
+ * @session: a #TranslitSession
+ *
+ * Returns: (transfer none): the #TranslitTransliterator of @session
+ */
+TranslitTransliterator *
+translit_session_get_transliterator (TranslitSession *session)
+{
+  g_return_val_if_fail (TRANSLIT_IS_SESSION (session), NULL);
+
+  return session->priv->transliterator;
+}
+
+/**
+ * translit_session_append:
+ * @session: a #TranslitSession
+ * @input: (array length=len) (element-type guint8): input in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ * @committed: a #GString where newly committed output is appended
+ * @error: a #GError
+ *
+ * Feed @input to @session.  The output which will no longer change
+ * is appended to @committed; the rest is available with
+ * translit_session_get_pending().
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+translit_session_append (TranslitSession *session,
+			 const gchar     *input,
+			 gssize           len,
+			 GString         *committed,
+			 GError         **error)
+{
+  gsize byte_len;
+
+  g_return_val_if_fail (TRANSLIT_IS_SESSION (session), FALSE);
+  g_return_val_if_fail (input != NULL || len == 0, FALSE);
+  g_return_val_if_fail (committed != NULL, FALSE);
+
+  if (!_translit_utf8_validate_count (input, len, &byte_len, NULL))
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_INVALID_INPUT,
+		   "not a valid UTF-8 sequence");
+      return FALSE;
+    }
+
+  return TRANSLIT_SESSION_GET_CLASS (session)->
+    append (session, input, byte_len, committed, error);
+}
+
+/**
+ * translit_session_finish:
+ * @session: a #TranslitSession
+ * @committed: a #GString where the remaining output is appended
+ * @error: a #GError
+ *
+ * Commit the pending output of @session, as if the end of input is
+ * reached.  After this, @session can be used for new input.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+translit_session_finish (TranslitSession *session,
+			 GString         *committed,
+			 GError         **error)
+{
+  g_return_val_if_fail (TRANSLIT_IS_SESSION (session), FALSE);
+  g_return_val_if_fail (committed != NULL, FALSE);
+
+  return TRANSLIT_SESSION_GET_CLASS (session)->
+    finish (session, committed, error);
+}
+
+/**
+ * translit_session_reset:
+ * @session: a #TranslitSession
+ *
+ * Discard the pending input of @session.
+ */
+void
+translit_session_reset (TranslitSession *session)
+{
+  g_return_if_fail (TRANSLIT_IS_SESSION (session));
+
+  TRANSLIT_SESSION_GET_CLASS (session)->reset (session);
+}
+
+/**
+ * translit_session_get_pending:
+ * @session: a #TranslitSession
+ *
+ * Get the output for the input which has not been committed yet,
+ * e.g. the preedit string of an input method.
+ *
+ * Returns: the pending output, owned by @session
+ */
+const gchar *
+translit_session_get_pending (TranslitSession *session)
+{
+  g_return_val_if_fail (TRANSLIT_IS_SESSION (session), NULL);
+
+  return TRANSLIT_SESSION_GET_CLASS (session)->get_pending (session);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSLIT_SESSION_H__
+#define __TRANSLIT_SESSION_H__
+
+#include <glib-object.h>
+#include <libtranslit/translittransliterator.h>
+
+G_BEGIN_DECLS
+
+#define TRANSLIT_TYPE_SESSION (translit_session_get_type())
+#define TRANSLIT_SESSION(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TRANSLIT_TYPE_SESSION, TranslitSession))
+#define TRANSLIT_SESSION_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TRANSLIT_TYPE_SESSION, TranslitSessionClass))
+#define TRANSLIT_IS_SESSION(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), TRANSLIT_TYPE_SESSION))
+#define TRANSLIT_IS_SESSION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), TRANSLIT_TYPE_SESSION))
+#define TRANSLIT_SESSION_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), TRANSLIT_TYPE_SESSION, TranslitSessionClass))
+
+typedef struct _TranslitSession TranslitSession;
+typedef struct _TranslitSessionClass TranslitSessionClass;
+typedef struct _TranslitSessionPrivate TranslitSessionPrivate;
+
+struct _TranslitSession
+{
+  /*< private >*/
+  GObject parent;
+
+  TranslitSessionPrivate *priv;
+};
+
+struct _TranslitSessionClass
+{
+  /*< private >*/
+  GObjectClass parent_class;
+
+  /*< public >*/
+  gboolean      (*append)      (TranslitSession *session,
+                                const gchar     *input,
+                                gsize            len,
+                                GString         *committed,
+                                GError         **error);
+  gboolean      (*finish)      (TranslitSession *session,
+                                GString         *committed,
+                                GError         **error);
+  void          (*reset)       (TranslitSession *session);
+  const gchar * (*get_pending) (TranslitSession *session);
+};
+
+GType                   translit_session_get_type
+                        (void) G_GNUC_CONST;
+TranslitSession        *translit_session_new
+                        (TranslitTransliterator *transliterator);
+TranslitTransliterator *translit_session_get_transliterator
+                        (TranslitSession        *session);
+gboolean                translit_session_append
+                        (TranslitSession        *session,
+                         const gchar            *input,
+                         gssize                  len,
+                         GString                *committed,
+                         GError                **error);
+gboolean                translit_session_finish
+                        (TranslitSession        *session,
+                         GString                *committed,
+                         GError                **error);
+void                    translit_session_reset
+                        (TranslitSession        *session);
+const gchar            *translit_session_get_pending
+                        (TranslitSession        *session);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_SESSION_H__ */
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "translitprivate.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+/**
+ * SECTION:translittrace
+ * @short_description: recording of tracing spans
+ *
+ * When tracing is enabled, with translit_trace_enable() or by setting
+ * the TRANSLIT_TRACE environment variable to a file name, libtranslit
+ * records spans around loading modules, creating transliterators,
+ * validating input and running the backends.  The spans are kept in
+ * a ring buffer per thread, and translit_trace_dump() writes them in
+ * the Chrome trace event format, which chrome://tracing and Perfetto
+ * can display.  With TRANSLIT_TRACE, they are written to the file at
+ * exit.
+ */
+
+/* the number of spans kept per thread */
+#define RING_SIZE 8192
+
+/* the maximum nesting of spans; deeper spans are not recorded */
+#define MAX_DEPTH 32
+
+typedef struct _TraceEvent TraceEvent;
+
+struct _TraceEvent
+{
+  const gchar *name;
+  guint64 start;
+  guint64 duration;
+};
+
+typedef struct _TraceBuffer TraceBuffer;
+
+struct _TraceBuffer
+{
+  /* protects EVENTS, HEAD and N_EVENTS against translit_trace_dump */
+  GMutex mutex;
+  TraceEvent events[RING_SIZE];
+  guint head;
+  guint n_events;
+
+  guint tid;
+
+  /* the open spans; only accessed by the owning thread */
+  TraceEvent stack[MAX_DEPTH];
+  guint depth;
+  gint generation;
+};
+
+volatile gint _translit_trace_enabled = 0;
+
+/* incremented each time tracing is enabled, so that spans left open
+ * when it was disabled are discarded */
+static volatile gint generation = 0;
+
+/* The buffers of all the threads, kept after the threads exit so
+ * that their spans can still be dumped.  */
+G_LOCK_DEFINE_STATIC (buffers);
+static GSList *buffers = NULL;
+static guint n_buffers = 0;
+
+static GPrivate buffer_key = G_PRIVATE_INIT (NULL);
+
+static gchar *trace_filename = NULL;
+
+static TraceBuffer *
+get_buffer (void)
+{
+  TraceBuffer *buffer;
+
+  buffer = g_private_get (&buffer_key);
+  if (G_UNLIKELY (buffer == NULL))
+    {
+      buffer = g_new0 (TraceBuffer, 1);
+      g_mutex_init (&buffer->mutex);
+      G_LOCK (buffers);
+      buffer->tid = ++n_buffers;
+      buffers = g_slist_prepend (buffers, buffer);
+      G_UNLOCK (buffers);
+      g_private_set (&buffer_key, buffer);
+    }
+
+  if (G_UNLIKELY (buffer->generation != g_atomic_int_get (&generation)))
+    {
+      buffer->depth = 0;
+      buffer->generation = g_atomic_int_get (&generation);
+    }
+
+  return buffer;
+}
+
+/**
+ * translit_trace_enable:
+ *
+ * Start recording tracing spans.
+ */
+void
+translit_trace_enable (void)
+{
+  g_atomic_int_inc (&generation);
+  g_atomic_int_set (&_translit_trace_enabled, 1);
+}
+
+/**
+ * translit_trace_disable:
+ *
+ * Stop recording tracing spans.  The spans recorded so far are kept
+ * for translit_trace_dump().
+ */
+void
+translit_trace_disable (void)
+{
+  g_atomic_int_set (&_translit_trace_enabled, 0);
+}
+
+/**
+ * translit_trace_begin:
+ * @name: a static string naming the span
+ *
+ * Open a span in the current thread.  Backends may call this to
+ * record their own phases.  Each call must be matched by
+ * translit_trace_end() in the same thread.
+ */
+void
+translit_trace_begin (const gchar *name)
+{
+  TraceBuffer *buffer;
+
+  if (G_LIKELY (!g_atomic_int_get (&_translit_trace_enabled)))
+    return;
+
+  buffer = get_buffer ();
+  if (buffer->depth < MAX_DEPTH)
+    {
+      buffer->stack[buffer->depth].name = name;
+      buffer->stack[buffer->depth].start = _translit_get_time_ns ();
+    }
+  buffer->depth++;
+}
+
+/**
+ * translit_trace_end:
+ *
+ * Close the span opened last by translit_trace_begin() in the current
+ * thread.
+ */
+void
+translit_trace_end (void)
+{
+  TraceBuffer *buffer;
+  TraceEvent *event;
+
+  if (G_LIKELY (!g_atomic_int_get (&_translit_trace_enabled)))
+    return;
+
+  buffer = get_buffer ();
+  if (buffer->depth == 0)
+    return;
+
+  buffer->depth--;
+  if (buffer->depth >= MAX_DEPTH)
+    return;
+
+  event = &buffer->stack[buffer->depth];
+  event->duration = _translit_get_time_ns () - event->start;
+
+  g_mutex_lock (&buffer->mutex);
+  buffer->events[buffer->head] = *event;
+  buffer->head = (buffer->head + 1) % RING_SIZE;
+  if (buffer->n_events < RING_SIZE)
+    buffer->n_events++;
+  g_mutex_unlock (&buffer->mutex);
+}
+
+static void
+append_json_string (GString *json, const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (json, '"');
+  for (p = str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+	g_string_append_c (json, '\\');
+      if ((guchar) *p < 0x20)
+	g_string_append_printf (json, "\\u%04x", *p);
+      else
+	g_string_append_c (json, *p);
+    }
+  g_string_append_c (json, '"');
+}
+
+/**
+ * translit_trace_dump:
+ * @filename: the name of the file to write
+ * @error: a #GError
+ *
+ * Write the spans recorded so far to @filename, as JSON in the Chrome
+ * trace event format.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+translit_trace_dump (const gchar *filename,
+		     GError     **error)
+{
+  GString *json;
+  GSList *l;
+  gboolean first = TRUE, retval;
+  gint pid = 0;
+
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+#ifdef G_OS_UNIX
+  pid = getpid ();
+#endif
+
+  json = g_string_new ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  G_LOCK (buffers);
+  for (l = buffers; l; l = l->next)
+    {
+      TraceBuffer *buffer = l->data;
+      guint i, index;
+
+      g_mutex_lock (&buffer->mutex);
+      index = (buffer->head + RING_SIZE - buffer->n_events) % RING_SIZE;
+      for (i = 0; i < buffer->n_events; i++)
+	{
+	  TraceEvent *event = &buffer->events[index];
+	  gchar ts[G_ASCII_DTOSTR_BUF_SIZE], dur[G_ASCII_DTOSTR_BUF_SIZE];
+
+	  /* Chrome traces are in microseconds.  */
+	  g_ascii_formatd (ts, sizeof (ts), "%.3f", event->start / 1000.0);
+	  g_ascii_formatd (dur, sizeof (dur), "%.3f", event->duration / 1000.0);
+
+	  if (!first)
+	    g_string_append_c (json, ',');
+	  first = FALSE;
+
+	  g_string_append (json, "\n{\"name\":");
+	  append_json_string (json, event->name);
+	  g_string_append_printf (json,
+				  ",\"cat\":\"translit\",\"ph\":\"X\""
+				  ",\"ts\":%s,\"dur\":%s,\"pid\":%d,\"tid\":%u}",
+				  ts, dur, pid, buffer->tid);
+
+	  index = (index + 1) % RING_SIZE;
+	}
+      g_mutex_unlock (&buffer->mutex);
+    }
+  G_UNLOCK (buffers);
+
+  g_string_append (json, "\n]}\n");
+
+  retval = g_file_set_contents (filename, json->str, json->len, error);
+  g_string_free (json, TRUE);
+
+  return retval;
+}
+
+static void
+dump_at_exit (void)
+{
+  GError *error = NULL;
+
+  if (!translit_trace_dump (trace_filename, &error))
+    {
+      g_printerr ("can't write trace to %s: %s\n",
+		  trace_filename, error->message);
+      g_error_free (error);
+    }
+}
+
+/* Enable tracing if TRANSLIT_TRACE is set.  */
+void
+_translit_trace_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const gchar *filename = g_getenv ("TRANSLIT_TRACE");
+
+      if (filename && *filename)
+	{
+	  trace_filename = g_strdup (filename);
+	  atexit (dump_at_exit);
+	  translit_trace_enable ();
+	}
+      g_once_init_leave (&initialized, 1);
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __TRANSLIT_TRACE_H__
+#define __TRANSLIT_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void     translit_trace_enable  (void);
+void     translit_trace_disable (void);
+gboolean translit_trace_dump    (const gchar *filename,
+                                 GError     **error);
+void     translit_trace_begin   (const gchar *name);
+void     translit_trace_end     (void);
+
+G_END_DECLS
+
+#endif	/* __TRANSLIT_TRACE_H__ */
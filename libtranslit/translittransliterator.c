@@ -19,6 +19,17 @@
 #include "config.h"
 #include <gio/gio.h>
 #include <libtranslit/translit.h>
+#include "translitprivate.h"
+#include <glib/gstdio.h>
+#include <string.h>
+
+#ifdef BUILTIN_ICU
+#include "transliteratoricu.h"
+#endif
+
+#ifdef BUILTIN_M17N
+#include "transliteratorm17n.h"
+#endif
 
 enum
   {
@@ -34,18 +45,111 @@ G_DEFINE_TYPE (TranslitTransliterator, translit_transliterator, G_TYPE_OBJECT);
 struct _TranslitTransliteratorPrivate
 {
   gchar *name;
+
+  /* instances used by translit_transliterator_transliterate_parallel */
+  TranslitPool *pool;
+
+  /* results of translit_transliterator_transliterate, or NULL */
+  TranslitCache *cache;
+  TranslitCacheMode cache_mode;
+
+  /* whether the inputs are known to be valid UTF-8 */
+  gboolean trusted_input;
+
+#ifdef ENABLE_STATS
+  /* see TranslitTransliteratorStats; only accessed through
+   * stats_add(), stats_get() and stats_max() */
+  guint64 calls;
+  guint64 input_bytes;
+  guint64 output_bytes;
+  guint64 total_ns;
+  guint64 max_ns;
+  guint64 errors;
+  guint64 retries;
+  guint64 histogram[TRANSLIT_STATS_HISTOGRAM_SIZE];
+#endif
 };
 
+G_LOCK_DEFINE_STATIC (pool);
+
+#ifdef ENABLE_STATS
+/* The counters are 64-bit even on 32-bit platforms, where the GLib
+ * atomic operations only cover 32 bits.  Use the compiler builtins
+ * where 64-bit atomic operations are native, and a lock otherwise.  */
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8) && defined(__ATOMIC_RELAXED)
+static inline void
+stats_add (guint64 *counter, guint64 value)
+{
+  __atomic_fetch_add (counter, value, __ATOMIC_RELAXED);
+}
+
+static inline guint64
+stats_get (guint64 *counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+/* Raise COUNTER to VALUE, if it is lower.  */
+static inline void
+stats_max (guint64 *counter, guint64 value)
+{
+  guint64 current = __atomic_load_n (counter, __ATOMIC_RELAXED);
+
+  while (value > current
+	 && !__atomic_compare_exchange_n (counter, &current, value, TRUE,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+#else
+G_LOCK_DEFINE_STATIC (stats);
+
+static inline void
+stats_add (guint64 *counter, guint64 value)
+{
+  G_LOCK (stats);
+  *counter += value;
+  G_UNLOCK (stats);
+}
+
+static inline guint64
+stats_get (guint64 *counter)
+{
+  guint64 value;
+
+  G_LOCK (stats);
+  value = *counter;
+  G_UNLOCK (stats);
+
+  return value;
+}
+
+/* Raise COUNTER to VALUE, if it is lower.  */
+static inline void
+stats_max (guint64 *counter, guint64 value)
+{
+  G_LOCK (stats);
+  if (value > *counter)
+    *counter = value;
+  G_UNLOCK (stats);
+}
+#endif
+#endif
+
 typedef struct _TranslitModule TranslitModule;
 typedef struct _TranslitModuleClass TranslitModuleClass;
 
 struct _TranslitModule
 {
   GTypeModule parent;
+
+  /* NULL for the module of the backends linked into the library */
   gchar *filename;
   GModule *library;
   gboolean initialized;
 
+  /* names of the backends the module implements */
+  GSList *backends;
+
   void (*load)   (TranslitModule *module);
   void (*unload) (TranslitModule *module);
 };
@@ -72,7 +176,14 @@ translit_module_real_load (GTypeModule *gmodule)
 {
   TranslitModule *module = TRANSLIT_MODULE (gmodule);
 
-  g_return_val_if_fail (module->filename, FALSE);
+  if (module->filename == NULL)
+    {
+      g_return_val_if_fail (module->load, FALSE);
+
+      module->load (module);
+      module->initialized = TRUE;
+      return TRUE;
+    }
 
   module->library = g_module_open (module->filename,
 				   G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
@@ -111,6 +222,9 @@ translit_module_real_unload (GTypeModule *gmodule)
 
   module->unload (module);
 
+  if (module->library == NULL)
+    return;
+
   g_module_close (module->library);
   module->library = NULL;
 
@@ -124,6 +238,7 @@ translit_module_finalize (GObject *object)
   TranslitModule *module = TRANSLIT_MODULE (object);
 
   g_free (module->filename);
+  g_slist_free_full (module->backends, g_free);
 
   G_OBJECT_CLASS (translit_module_parent_class)->finalize (object);
 }
@@ -158,22 +273,267 @@ translit_module_new (const gchar *filename)
   return module;
 }
 
+#if defined(BUILTIN_ICU) || defined(BUILTIN_M17N)
+static void
+builtin_module_load (TranslitModule *module)
+{
+#ifdef BUILTIN_ICU
+  transliterator_icu_register (G_TYPE_MODULE (module));
+#endif
+#ifdef BUILTIN_M17N
+  transliterator_m17n_register (G_TYPE_MODULE (module));
+#endif
+}
+
+static void
+builtin_module_unload (TranslitModule *module)
+{
+}
+#endif
+
+/* The registry.  Lookups of existing transliterators only take the
+ * reader lock; loading modules and creating transliterators is
+ * serialized with LOAD_LOCK, which is recursive since modules call
+ * translit_implement_transliterator() while being loaded.  */
+static GRWLock registry_lock;
+static GRecMutex load_lock;
 static GHashTable *transliterators = NULL;
+static GHashTable *transliterators_by_id = NULL;
 static GHashTable *transliterator_types = NULL;
 
+/* Loaded modules, and the module caches read from each directory in
+ * the module path, or NULL if the directory has no valid cache.
+ * Both are protected by LOAD_LOCK.  */
+static GHashTable *modules = NULL;
+static GHashTable *module_caches = NULL;
+
+/* the module being loaded, to which translit_implement_transliterator()
+ * attributes the backends */
+static TranslitModule *loading_module = NULL;
+
+static void
+module_cache_free (gpointer data)
+{
+  if (data)
+    g_key_file_free (data);
+}
+
+static void
+registry_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      transliterators = g_hash_table_new_full (g_str_hash,
+					       g_str_equal,
+					       (GDestroyNotify) g_free,
+					       NULL);
+      transliterators_by_id = g_hash_table_new (g_direct_hash,
+						g_direct_equal);
+      transliterator_types = g_hash_table_new_full (g_str_hash,
+						    g_str_equal,
+						    (GDestroyNotify) g_free,
+						    NULL);
+      modules = g_hash_table_new_full (g_str_hash,
+				       g_str_equal,
+				       (GDestroyNotify) g_free,
+				       NULL);
+      module_caches = g_hash_table_new_full (g_str_hash,
+					     g_str_equal,
+					     (GDestroyNotify) g_free,
+					     module_cache_free);
+      _translit_trace_init ();
+
+      /* The "chain" backend is part of the library.  */
+      g_hash_table_insert (transliterator_types,
+			   g_strdup ("chain"),
+			   GSIZE_TO_POINTER (transliterator_chain_get_type ()));
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
 GQuark
 translit_error_quark (void)
 {
   return g_quark_from_static_string ("translit-error-quark");
 }
 
-static gchar *
+static gboolean translit_transliterator_real_transliterate_full
+                            (TranslitTransliterator *self,
+                             const gchar            *input,
+                             gsize                   len,
+                             gssize                  n_chars,
+                             GString                *output,
+                             guint                  *endpos,
+                             TranslitResult         *result,
+                             GError                **error);
+
+static gboolean
 translit_transliterator_real_transliterate (TranslitTransliterator *self,
                                             const gchar            *input,
+                                            gsize                   len,
+                                            GString                *output,
                                             guint                  *endpos,
                                             GError                **error)
 {
-  return NULL;
+  TranslitTransliteratorClass *klass = TRANSLIT_TRANSLITERATOR_GET_CLASS (self);
+
+  if (klass->transliterate_full
+      != translit_transliterator_real_transliterate_full)
+    return klass->transliterate_full (self, input, len, -1, output, endpos,
+				      NULL, error);
+
+  g_set_error (error,
+	       TRANSLIT_ERROR,
+	       TRANSLIT_ERROR_FAILED,
+	       "transliterate is not implemented by %s",
+	       G_OBJECT_TYPE_NAME (self));
+  return FALSE;
+}
+
+static gboolean
+translit_transliterator_real_transliterate_full (TranslitTransliterator *self,
+                                                 const gchar            *input,
+                                                 gsize                   len,
+                                                 gssize                  n_chars,
+                                                 GString                *output,
+                                                 guint                  *endpos,
+                                                 TranslitResult         *result,
+                                                 GError                **error)
+{
+  gsize offset = output->len;
+  guint n;
+
+  if (!TRANSLIT_TRANSLITERATOR_GET_CLASS (self)->
+      transliterate (self, input, len, output, &n, error))
+    return FALSE;
+
+  if (endpos)
+    *endpos = n;
+
+  /* Without knowing more about the backend, the whole input maps to
+   * the whole output.  */
+  if (result)
+    _translit_result_set_whole (result, input, len, n, output->len - offset);
+
+  return TRUE;
+}
+
+static gboolean
+transliterate_batch_default (TranslitTransliterator *self,
+			     const gchar * const    *inputs,
+			     gsize                   n_inputs,
+			     gchar                 **outputs,
+			     guint                  *endpos,
+			     TranslitArena          *arena,
+			     GError                **error)
+{
+  TranslitTransliteratorClass *klass = TRANSLIT_TRANSLITERATOR_GET_CLASS (self);
+  GString *output;
+  gsize i;
+
+  output = arena ? translit_arena_get_scratch (arena) : g_string_new (NULL);
+  for (i = 0; i < n_inputs; i++)
+    {
+      g_string_truncate (output, 0);
+      if (!klass->transliterate_full (self,
+				      inputs[i], strlen (inputs[i]), -1,
+				      output,
+				      &endpos[i],
+				      NULL,
+				      error))
+	break;
+      outputs[i] = translit_arena_strndup (arena, output->str, output->len);
+    }
+  if (arena == NULL)
+    g_string_free (output, TRUE);
+
+  return i == n_inputs;
+}
+
+static gboolean
+translit_transliterator_real_transliterate_batch_arena (TranslitTransliterator *self,
+							const gchar * const    *inputs,
+							gsize                   n_inputs,
+							gchar                 **outputs,
+							guint                  *endpos,
+							TranslitArena          *arena,
+							GError                **error);
+
+static gboolean
+translit_transliterator_real_transliterate_batch (TranslitTransliterator *self,
+                                                  const gchar * const    *inputs,
+                                                  gsize                   n_inputs,
+                                                  gchar                 **outputs,
+                                                  guint                  *endpos,
+                                                  GError                **error)
+{
+  TranslitTransliteratorClass *klass = TRANSLIT_TRANSLITERATOR_GET_CLASS (self);
+
+  if (klass->transliterate_batch_arena
+      != translit_transliterator_real_transliterate_batch_arena)
+    return klass->transliterate_batch_arena (self, inputs, n_inputs,
+					     outputs, endpos, NULL, error);
+
+  return transliterate_batch_default (self, inputs, n_inputs,
+				      outputs, endpos, NULL, error);
+}
+
+static gboolean
+translit_transliterator_real_transliterate_batch_arena (TranslitTransliterator *self,
+							const gchar * const    *inputs,
+							gsize                   n_inputs,
+							gchar                 **outputs,
+							guint                  *endpos,
+							TranslitArena          *arena,
+							GError                **error)
+{
+  TranslitTransliteratorClass *klass = TRANSLIT_TRANSLITERATOR_GET_CLASS (self);
+
+  /* A backend which only implements transliterate_batch can't
+   * allocate from ARENA.  */
+  if (arena == NULL
+      && klass->transliterate_batch
+      != translit_transliterator_real_transliterate_batch)
+    return klass->transliterate_batch (self, inputs, n_inputs,
+				       outputs, endpos, error);
+
+  return transliterate_batch_default (self, inputs, n_inputs,
+				      outputs, endpos, arena, error);
+}
+
+static TranslitSession *
+translit_transliterator_real_create_session (TranslitTransliterator *self)
+{
+  return g_object_new (TRANSLIT_TYPE_SESSION, "transliterator", self, NULL);
+}
+
+static TranslitTransliterator *
+translit_transliterator_real_clone (TranslitTransliterator *self,
+				    GError                **error)
+{
+  GType type = G_OBJECT_TYPE (self);
+
+  if (g_type_is_a (type, G_TYPE_INITABLE))
+    return g_initable_new (type, NULL, error, "name", self->priv->name, NULL);
+
+  return g_object_new (type, "name", self->priv->name, NULL);
+}
+
+static gboolean
+translit_transliterator_real_would_change (TranslitTransliterator *self,
+					   const gchar            *input,
+					   gsize                   len)
+{
+  /* Without knowing anything about the backend, assume the worst.  */
+  return TRUE;
+}
+
+static TranslitTransliteratorFlags
+translit_transliterator_real_get_flags (TranslitTransliterator *self)
+{
+  return TRANSLIT_TRANSLITERATOR_FLAGS_NONE;
 }
 
 static void
@@ -225,6 +585,10 @@ translit_transliterator_finalize (GObject *object)
   TranslitTransliterator *trans = TRANSLIT_TRANSLITERATOR (object);
 
   g_free (trans->priv->name);
+  if (trans->priv->pool)
+    translit_pool_unref (trans->priv->pool);
+  if (trans->priv->cache)
+    _translit_cache_free (trans->priv->cache);
 
   G_OBJECT_CLASS (translit_transliterator_parent_class)->finalize (object);
 }
@@ -236,6 +600,15 @@ translit_transliterator_class_init (TranslitTransliteratorClass *klass)
   GParamSpec *pspec;
 
   klass->transliterate = translit_transliterator_real_transliterate;
+  klass->transliterate_batch =
+    translit_transliterator_real_transliterate_batch;
+  klass->create_session = translit_transliterator_real_create_session;
+  klass->clone = translit_transliterator_real_clone;
+  klass->would_change = translit_transliterator_real_would_change;
+  klass->get_flags = translit_transliterator_real_get_flags;
+  klass->transliterate_full = translit_transliterator_real_transliterate_full;
+  klass->transliterate_batch_arena =
+    translit_transliterator_real_transliterate_batch_arena;
 
   object_class->set_property = translit_transliterator_set_property;
   object_class->get_property = translit_transliterator_get_property;
@@ -263,200 +636,1722 @@ translit_transliterator_init (TranslitTransliterator *self)
   self->priv = TRANSLIT_TRANSLITERATOR_GET_PRIVATE (self);
 }
 
-/**
- * translit_transliterator_transliterate:
- * @transliterator: a #TranslitTransliterator
- * @input: an input string in UTF-8
- * @endpos: (out) (allow-none): ending position of transliteration (in chars)
- * @error: a #GError
- *
- * Returns: a newly allocated output string
- */
-gchar *
-translit_transliterator_transliterate (TranslitTransliterator *transliterator,
-                                       const gchar            *input,
-                                       guint                  *endpos,
-                                       GError                **error)
+/* Return the length of the longest prefix of TEXT which ends at a
+ * place where no transliteration context needs to be kept, that is,
+ * right after a newline or, failing that and if POLICY allows, after
+ * a whitespace.  */
+gsize
+_translit_find_boundary (const gchar        *text,
+			 gsize               len,
+			 TranslitSplitPolicy policy)
 {
-  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  gsize i;
+
+  for (i = len; i > 0; i--)
+    if (text[i - 1] == '\n')
+      return i;
 
-  if (!g_utf8_validate (input, -1, NULL))
+  if (policy == TRANSLIT_SPLIT_WHITESPACE)
+    for (i = len; i > 0; i--)
+      if (g_ascii_isspace (text[i - 1]))
+	return i;
+
+  return 0;
+}
+
+/* Validate INPUT, unless the caller vouched for it, and return its
+ * length in bytes in LEN and in characters in N_CHARS, or -1 if the
+ * latter is not known.  On error, LEN is still set, for the
+ * statistics.  */
+static gboolean
+check_input (TranslitTransliterator *transliterator,
+	     const gchar            *input,
+	     gssize                 *len,
+	     gssize                 *n_chars,
+	     GError                **error)
+{
+  gsize byte_len, count;
+  gboolean valid;
+
+  if (transliterator->priv->trusted_input)
+    {
+      if (*len < 0)
+	*len = strlen (input);
+      *n_chars = -1;
+      return TRUE;
+    }
+
+  TRANSLIT_TRACE_BEGIN ("validate");
+  valid = _translit_utf8_validate_count (input, *len, &byte_len, &count);
+  TRANSLIT_TRACE_END ();
+
+  if (!valid)
     {
+      if (*len < 0)
+	*len = strlen (input);
       g_set_error (error,
 		   TRANSLIT_ERROR,
 		   TRANSLIT_ERROR_INVALID_INPUT,
 		   "not a valid UTF-8 sequence");
-      return NULL;
+      return FALSE;
     }
 
-  return TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
-    transliterate (transliterator, input, endpos, error);
+  *len = byte_len;
+  *n_chars = count;
+  return TRUE;
 }
 
-static gchar *
-build_module_filename (const gchar *name)
+/**
+ * translit_transliterator_clone:
+ * @transliterator: a #TranslitTransliterator
+ * @error: a #GError
+ *
+ * Create a new instance of @transliterator.  A
+ * #TranslitTransliterator instance is not thread-safe; use this
+ * function (or #TranslitPool) to get an instance per thread.  If
+ * @transliterator has %TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE,
+ * the clone is not independent of it: the backend library keeps
+ * global state, and the two must not be used at the same time.  Unlike
+ * translit_transliterator_get(), this does not recompile the
+ * transliteration rules where the backend can share them.
+ *
+ * Returns: (transfer full): a new #TranslitTransliterator
+ */
+TranslitTransliterator *
+translit_transliterator_clone (TranslitTransliterator *transliterator,
+			       GError                **error)
 {
-#if !defined(G_OS_WIN32) && !defined(G_WITH_CYGWIN)
-  return g_strdup_printf ("libtranslit%s.so", name);
-#else
-  return g_strdup_printf ("translit%s.dll", name);
-#endif
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+
+  return TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
+    clone (transliterator, error);
 }
 
-static void
-load_module (const gchar **paths, const char *module_name)
+/**
+ * translit_transliterator_would_change:
+ * @transliterator: a #TranslitTransliterator
+ * @input: (array length=len) (element-type guint8): an input string in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ *
+ * Check cheaply whether @transliterator may change @input, so that
+ * the strings which need no work can be skipped.  This may give
+ * false positives, but never false negatives.
+ *
+ * Returns: %FALSE if translit_transliterator_transliterate() would
+ * return @input unchanged, %TRUE otherwise
+ */
+gboolean
+translit_transliterator_would_change (TranslitTransliterator *transliterator,
+				      const gchar            *input,
+				      gssize                  len)
 {
-  const gchar *name;
-  gchar *path, *module_filename;
+  gssize n_chars;
 
-  if (!g_module_supported ())
-    return;
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), TRUE);
+  g_return_val_if_fail (input != NULL || len == 0, TRUE);
 
-  module_filename = build_module_filename (module_name);
+  /* Let translit_transliterator_transliterate() report the error.  */
+  if (!check_input (transliterator, input, &len, &n_chars, NULL))
+    return TRUE;
 
-  for (; *paths; paths++)
-    {
-      GDir *dir;
+  return TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
+    would_change (transliterator, input, len);
+}
 
-      dir = g_dir_open (*paths, 0, NULL);
-      if (!dir)
-	{
-	  g_free (module_filename);
-	  return;
-	}
+/**
+ * translit_transliterator_get_flags:
+ * @transliterator: a #TranslitTransliterator
+ *
+ * Returns: the #TranslitTransliteratorFlags declared by the backend
+ */
+TranslitTransliteratorFlags
+translit_transliterator_get_flags (TranslitTransliterator *transliterator)
+{
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator),
+			TRANSLIT_TRANSLITERATOR_FLAGS_NONE);
 
-      while ((name = g_dir_read_name (dir)))
-	{
-	  if (g_strcmp0 (name, module_filename) == 0)
-	    {
-	      TranslitModule *module;
-	      gchar *path;
-
-	      path = g_build_filename (*paths, name, NULL);
-	      module = translit_module_new (path);
-
-	      if (g_type_module_use (G_TYPE_MODULE (module)))
-		{
-		  g_free (path);
-		  g_dir_close (dir);
-		  g_free (module_filename);
-		  return;
-		}
-
-	      g_printerr ("Failed to load module: %s\n", path);
-	      g_object_unref (module);
-	      g_free (path);
-	    }
-	}
-      g_dir_close (dir);
-    }
-  g_free (module_filename);
+  return TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
+    get_flags (transliterator);
 }
 
 /**
- * translit_transliterator_get:
- * @backend: backend name (e.g. "m17n")
- * @name: name of the transliterator (e.g. "hi-inscript")
- * @error: a #GError
+ * translit_transliterator_set_cache_size:
+ * @transliterator: a #TranslitTransliterator
+ * @max_entries: the maximum number of cached results, or 0 to
+ * disable the cache
+ * @max_bytes: the maximum size of the cached results in bytes, or 0
+ * for no limit
  *
- * Get a transliterator instance whose name is @name.
+ * Enable caching of the results of
+ * translit_transliterator_transliterate() and
+ * translit_transliterator_transliterate_append(), keyed by the input.
+ * The least recently used results are evicted when either of the
+ * limits is reached.  The cache is split into several parts with
+ * their own locks, so that it can be used from multiple threads; the
+ * limits apply to all the parts together.
  *
- * Returns: (transfer none): a #TranslitTransliterator
+ * This has no effect if the backend declares
+ * %TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE.  This function itself
+ * must not be called while @transliterator is used by other threads;
+ * any previously cached results are dropped.
  */
-TranslitTransliterator *
-translit_transliterator_get (const gchar *backend,
-			     const gchar *name,
-			     GError     **error)
+void
+translit_transliterator_set_cache_size (TranslitTransliterator *transliterator,
+					guint                   max_entries,
+					gsize                   max_bytes)
 {
-  gchar *transliterator_id;
-  GType transliterator_type;
-  TranslitTransliterator *transliterator = NULL;
-  GParameter transliterator_parameters[1] = {
-    { "name", { 0 } }
-  };
-  gpointer data;
+  TranslitTransliteratorPrivate *priv;
 
-  transliterator_id = g_strdup_printf ("%s:%s", backend, name);
-  if (transliterators != NULL)
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
+
+  priv = transliterator->priv;
+
+  if (priv->cache)
     {
-      transliterator = g_hash_table_lookup (transliterators, transliterator_id);
-      if (transliterator != NULL)
-	{
-	  g_free (transliterator_id);
-	  return transliterator;
-	}
+      _translit_cache_free (priv->cache);
+      priv->cache = NULL;
     }
 
-  if (transliterator_types == NULL)
-    transliterator_types = g_hash_table_new_full (g_str_hash,
-						  g_str_equal,
-						  (GDestroyNotify) g_free,
-						  NULL);
+  if (max_entries > 0
+      && (translit_transliterator_get_flags (transliterator)
+	  & TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE) == 0)
+    priv->cache = _translit_cache_new (max_entries, max_bytes);
+}
 
-  data = g_hash_table_lookup (transliterator_types, backend);
-  if (data == NULL)
-    {
-      const gchar *module_path;
-      gchar **paths;
-      gchar *default_paths[] = { MODULEDIR, NULL };
+/**
+ * translit_transliterator_set_cache_mode:
+ * @transliterator: a #TranslitTransliterator
+ * @mode: a #TranslitCacheMode
+ *
+ * Set what is cached in the cache enabled with
+ * translit_transliterator_set_cache_size().  With
+ * %TRANSLIT_CACHE_TOKENS, the input is split into words at
+ * whitespace, punctuation and script changes, and each distinct word
+ * is transliterated only once, which pays off on large texts where
+ * sentences differ but words repeat.  This is only used if the
+ * backend declares %TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS;
+ * otherwise the whole input is cached as with
+ * %TRANSLIT_CACHE_INPUT.
+ *
+ * Like translit_transliterator_set_cache_size(), this must not be
+ * called while @transliterator is used by other threads.
+ */
+void
+translit_transliterator_set_cache_mode (TranslitTransliterator *transliterator,
+					TranslitCacheMode       mode)
+{
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
 
-      module_path = g_getenv ("TRANSLIT_MODULE_PATH");
-      if (module_path)
-	paths = g_strsplit (module_path, G_SEARCHPATH_SEPARATOR_S, 0);
-      else
-	paths = g_strdupv (default_paths);
-      load_module ((const gchar **) paths, backend);
-      g_strfreev (paths);
-    }
+  transliterator->priv->cache_mode = mode;
+}
 
-  data = g_hash_table_lookup (transliterator_types, backend);
-  if (data == NULL)
-    {
-      g_free (transliterator_id);
-      g_set_error (error,
-		   TRANSLIT_ERROR,
-		   TRANSLIT_ERROR_NO_SUCH_BACKEND,
-		   "no such backend %s",
-		   backend);
-      return NULL;
-    }
+/**
+ * translit_transliterator_set_trusted_input:
+ * @transliterator: a #TranslitTransliterator
+ * @trusted: %TRUE if the inputs are known to be valid UTF-8
+ *
+ * Skip the validation of the inputs, for callers which have already
+ * validated them.  Passing an invalid UTF-8 sequence to
+ * @transliterator afterwards has undefined results.
+ *
+ * Like translit_transliterator_set_cache_size(), this must not be
+ * called while @transliterator is used by other threads.
+ */
+void
+translit_transliterator_set_trusted_input (TranslitTransliterator *transliterator,
+					   gboolean                trusted)
+{
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
 
-  transliterator_type = GPOINTER_TO_SIZE (data);
-  g_value_init (&transliterator_parameters[0].value, G_TYPE_STRING);
-  g_value_take_string (&transliterator_parameters[0].value, name);
+  transliterator->priv->trusted_input = trusted;
+}
+
+/**
+ * translit_transliterator_get_cache_stats:
+ * @transliterator: a #TranslitTransliterator
+ * @hits: (out): return location for the number of cache hits
+ * @misses: (out): return location for the number of cache misses
+ *
+ * Get the number of lookups in the cache enabled with
+ * translit_transliterator_set_cache_size() which have been found or
+ * not.  Both are zero if the cache is not enabled.
+ */
+void
+translit_transliterator_get_cache_stats (TranslitTransliterator *transliterator,
+					 guint64                *hits,
+					 guint64                *misses)
+{
+  guint64 n_hits = 0, n_misses = 0;
+
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
+
+  if (transliterator->priv->cache)
+    _translit_cache_get_stats (transliterator->priv->cache,
+			       &n_hits, &n_misses);
+
+  if (hits)
+    *hits = n_hits;
+  if (misses)
+    *misses = n_misses;
+}
+
+/**
+ * translit_transliterator_get_stats:
+ * @transliterator: a #TranslitTransliterator
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Get the statistics of the calls to @transliterator through
+ * translit_transliterator_transliterate() and its variants.  Each
+ * batch or parallel call counts as one call.  The counters are
+ * updated atomically, so this may be called while @transliterator is
+ * in use, though the fields are not read as a single snapshot.
+ *
+ * All the fields are zero if libtranslit was configured with
+ * --disable-stats.
+ */
+void
+translit_transliterator_get_stats (TranslitTransliterator      *transliterator,
+				   TranslitTransliteratorStats *stats)
+{
+#ifdef ENABLE_STATS
+  TranslitTransliteratorPrivate *priv;
+  gint i;
+#endif
+
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
+  g_return_if_fail (stats != NULL);
+
+  memset (stats, 0, sizeof (*stats));
+
+#ifdef ENABLE_STATS
+  priv = transliterator->priv;
+  stats->calls = stats_get (&priv->calls);
+  stats->input_bytes = stats_get (&priv->input_bytes);
+  stats->output_bytes = stats_get (&priv->output_bytes);
+  stats->total_ns = stats_get (&priv->total_ns);
+  stats->max_ns = stats_get (&priv->max_ns);
+  stats->errors = stats_get (&priv->errors);
+  stats->retries = stats_get (&priv->retries);
+  for (i = 0; i < TRANSLIT_STATS_HISTOGRAM_SIZE; i++)
+    stats->histogram[i] = stats_get (&priv->histogram[i]);
+#endif
+}
+
+/**
+ * translit_transliterator_add_retries:
+ * @transliterator: a #TranslitTransliterator
+ * @n_retries: the number of retries
+ *
+ * Account for @n_retries in the statistics of @transliterator.
+ * Backends call this when they have to enlarge their buffers in the
+ * middle of a call.
+ */
+void
+translit_transliterator_add_retries (TranslitTransliterator *transliterator,
+				     guint                   n_retries)
+{
+  g_return_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator));
+
+#ifdef ENABLE_STATS
+  stats_add (&transliterator->priv->retries, n_retries);
+#endif
+}
+
+/* Call the backend, within a tracing span.  N_CHARS is the number
+ * of characters in INPUT, or -1 if it is not known.  */
+static inline gboolean
+call_transliterate (TranslitTransliterator *transliterator,
+		    const gchar            *input,
+		    gsize                   len,
+		    gssize                  n_chars,
+		    GString                *output,
+		    guint                  *endpos,
+		    GError                **error)
+{
+  TranslitTransliteratorClass *klass =
+    TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator);
+  gboolean retval;
+
+  TRANSLIT_TRACE_BEGIN ("backend");
+  retval = klass->transliterate_full (transliterator,
+				      input, len, n_chars,
+				      output,
+				      endpos,
+				      NULL,
+				      error);
+  TRANSLIT_TRACE_END ();
+
+  return retval;
+}
+
+/* Token classes other than GUnicodeScript.  */
+#define TOKEN_CLASS_SPACE -1
+#define TOKEN_CLASS_PUNCT -2
+
+static gint
+token_class (gunichar uc, gint previous)
+{
+  GUnicodeScript script;
+
+  if (g_unichar_isspace (uc))
+    return TOKEN_CLASS_SPACE;
+  if (g_unichar_ispunct (uc))
+    return TOKEN_CLASS_PUNCT;
+
+  /* Combining marks belong to the preceding word.  */
+  script = g_unichar_get_script (uc);
+  if (script == G_UNICODE_SCRIPT_INHERITED && previous >= 0)
+    return previous;
+  return script;
+}
+
+/* Return the end of the token which starts at P, that is, the
+ * longest run of characters of the same class.  */
+static const gchar *
+token_end (const gchar *p, const gchar *end)
+{
+  gint klass;
+
+  klass = token_class (g_utf8_get_char (p), -1);
+  for (p = g_utf8_next_char (p); p < end; p = g_utf8_next_char (p))
+    if (token_class (g_utf8_get_char (p), klass) != klass)
+      break;
+  return p;
+}
+
+/* Transliterate INPUT token by token, so that the repeated words are
+ * looked up in CACHE, within and across calls.  */
+static gboolean
+transliterate_tokens (TranslitTransliterator *transliterator,
+		      TranslitCache          *cache,
+		      const gchar            *input,
+		      gsize                   len,
+		      GString                *output,
+		      guint                  *endpos,
+		      GError                **error)
+{
+  const gchar *p, *q, *end = input + len;
+  gsize orig_len = output->len, offset;
+  guint n_chars = 0, n;
+
+  for (p = input; p < end; p = q)
+    {
+      q = token_end (p, end);
+
+      if (!_translit_cache_lookup (cache, p, q - p, output, &n))
+	{
+	  offset = output->len;
+	  if (!call_transliterate (transliterator,
+				   p, q - p, -1,
+				   output,
+				   &n,
+				   error))
+	    {
+	      g_string_truncate (output, orig_len);
+	      return FALSE;
+	    }
+	  _translit_cache_insert (cache,
+				  p, q - p,
+				  output->str + offset, output->len - offset,
+				  n);
+	}
+      n_chars += n;
+    }
+
+  if (endpos)
+    *endpos = n_chars;
+
+  return TRUE;
+}
+
+static gboolean
+transliterate_cached (TranslitTransliterator *transliterator,
+		      const gchar            *input,
+		      gsize                   len,
+		      gssize                  n_chars,
+		      GString                *output,
+		      guint                  *endpos,
+		      GError                **error)
+{
+  TranslitCache *cache;
+  gsize offset;
+  guint n;
+
+  cache = transliterator->priv->cache;
+  if (cache == NULL)
+    return call_transliterate (transliterator, input, len, n_chars,
+			       output,
+			       endpos,
+			       error);
+
+  if (transliterator->priv->cache_mode == TRANSLIT_CACHE_TOKENS
+      && (translit_transliterator_get_flags (transliterator)
+	  & TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS) != 0)
+    return transliterate_tokens (transliterator, cache,
+				 input, len,
+				 output,
+				 endpos,
+				 error);
+
+  if (_translit_cache_lookup (cache, input, len, output, endpos))
+    return TRUE;
+
+  offset = output->len;
+  if (!call_transliterate (transliterator, input, len, n_chars, output, &n,
+			   error))
+    return FALSE;
+
+  _translit_cache_insert (cache,
+			  input, len,
+			  output->str + offset, output->len - offset,
+			  n);
+  if (endpos)
+    *endpos = n;
+
+  return TRUE;
+}
+
+#ifdef ENABLE_STATS
+#define stats_begin() _translit_get_time_ns ()
+
+/* Account a call which started at START.  */
+static void
+stats_end (TranslitTransliterator *transliterator,
+	   guint64                 start,
+	   gsize                   input_bytes,
+	   gsize                   output_bytes,
+	   gboolean                success)
+{
+  TranslitTransliteratorPrivate *priv = transliterator->priv;
+  guint64 elapsed;
+  guint bucket;
+
+  elapsed = _translit_get_time_ns () - start;
+
+  stats_add (&priv->calls, 1);
+  stats_add (&priv->input_bytes, input_bytes);
+  stats_add (&priv->output_bytes, output_bytes);
+  stats_add (&priv->total_ns, elapsed);
+  if (!success)
+    stats_add (&priv->errors, 1);
+
+  /* The bucket is the index of the highest bit set in ELAPSED;
+   * g_bit_storage() only takes a gulong.  */
+  for (bucket = 0;
+       bucket < TRANSLIT_STATS_HISTOGRAM_SIZE - 1
+	 && (elapsed >> (bucket + 1)) != 0;
+       bucket++)
+    ;
+  stats_add (&priv->histogram[bucket], 1);
+
+  stats_max (&priv->max_ns, elapsed);
+}
+#else
+#define stats_begin() G_GUINT64_CONSTANT (0)
+#define stats_end(transliterator,start,input_bytes,output_bytes,success) \
+  ((void) (start))
+#endif
+
+static gboolean
+translit_transliterator_transliterate_internal (TranslitTransliterator *transliterator,
+						const gchar            *input,
+						gssize                  len,
+						GString                *output,
+						guint                  *endpos,
+						GError                **error)
+{
+  guint64 start = stats_begin ();
+  gsize offset = output->len;
+  gssize n_chars;
+  gboolean retval;
+
+  TRANSLIT_TRACE_BEGIN ("transliterate");
+  retval = check_input (transliterator, input, &len, &n_chars, error);
+  if (retval)
+    {
+      /* Most transliterations produce about as many bytes as they
+       * consume, so make room for that at once.  */
+      if (output->allocated_len <= offset + len)
+	{
+	  g_string_set_size (output, offset + len);
+	  g_string_truncate (output, offset);
+	}
+      retval = transliterate_cached (transliterator, input, len, n_chars,
+				     output,
+				     endpos,
+				     error);
+    }
+  TRANSLIT_TRACE_END ();
+  stats_end (transliterator, start,
+	     len,
+	     retval ? output->len - offset : 0,
+	     retval);
+
+  return retval;
+}
+
+/**
+ * translit_transliterator_transliterate:
+ * @transliterator: a #TranslitTransliterator
+ * @input: an input string in UTF-8
+ * @endpos: (out) (allow-none): ending position of transliteration (in chars)
+ * @error: a #GError
+ *
+ * Returns: a newly allocated output string
+ */
+gchar *
+translit_transliterator_transliterate (TranslitTransliterator *transliterator,
+                                       const gchar            *input,
+                                       guint                  *endpos,
+                                       GError                **error)
+{
+  GString *output;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  g_return_val_if_fail (input != NULL, NULL);
+
+  /* The length is found while validating INPUT.  */
+  output = g_string_new (NULL);
+  if (!translit_transliterator_transliterate_internal (transliterator,
+						       input, -1,
+						       output,
+						       endpos,
+						       error))
+    {
+      g_string_free (output, TRUE);
+      return NULL;
+    }
+
+  return g_string_free (output, FALSE);
+}
+
+/**
+ * translit_transliterator_transliterate_arena:
+ * @transliterator: a #TranslitTransliterator
+ * @input: (array length=len) (element-type guint8): an input string in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ * @endpos: (out) (allow-none): ending position of transliteration (in chars)
+ * @arena: a #TranslitArena
+ * @error: a #GError
+ *
+ * Same as translit_transliterator_transliterate(), except that the
+ * output is allocated from @arena.  The output is built in a buffer
+ * owned by @arena and copied with its final size, so no memory is
+ * allocated from the system once @arena has grown large enough.
+ *
+ * Returns: (transfer none): the output string, or %NULL on error
+ */
+gchar *
+translit_transliterator_transliterate_arena (TranslitTransliterator *transliterator,
+					     const gchar            *input,
+					     gssize                  len,
+					     guint                  *endpos,
+					     TranslitArena          *arena,
+					     GError                **error)
+{
+  GString *output;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  g_return_val_if_fail (input != NULL || len == 0, NULL);
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  output = translit_arena_get_scratch (arena);
+  if (!translit_transliterator_transliterate_internal (transliterator,
+						       input, len,
+						       output,
+						       endpos,
+						       error))
+    return NULL;
+
+  return translit_arena_strndup (arena, output->str, output->len);
+}
+
+/**
+ * translit_transliterator_transliterate_append:
+ * @transliterator: a #TranslitTransliterator
+ * @input: (array length=len) (element-type guint8): an input string in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ * @output: a #GString where the output is appended
+ * @endpos: (out) (allow-none): ending position of transliteration (in chars)
+ * @error: a #GError
+ *
+ * Transliterate @input and append the result to @output.  Unlike
+ * translit_transliterator_transliterate(), @input need not be
+ * nul-terminated and no memory is allocated when @output already has
+ * enough room, so the same @output can be reused (after
+ * g_string_truncate()) across many calls.
+ *
+ * On error, @output is left with its original contents.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+translit_transliterator_transliterate_append (TranslitTransliterator *transliterator,
+					      const gchar            *input,
+					      gssize                  len,
+					      GString                *output,
+					      guint                  *endpos,
+					      GError                **error)
+{
+  gsize orig_len;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), FALSE);
+  g_return_val_if_fail (input != NULL || len == 0, FALSE);
+  g_return_val_if_fail (output != NULL, FALSE);
+
+  orig_len = output->len;
+  if (!translit_transliterator_transliterate_internal (transliterator,
+						       input, len,
+						       output,
+						       endpos,
+						       error))
+    {
+      g_string_truncate (output, orig_len);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * translit_transliterator_transliterate_full:
+ * @transliterator: a #TranslitTransliterator
+ * @input: (array length=len) (element-type guint8): an input string in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ * @output: a #GString where the output is appended
+ * @result: (allow-none): a #TranslitResult to fill, or %NULL
+ * @error: a #GError
+ *
+ * Like translit_transliterator_transliterate_append(), but fill
+ * @result with the ending position in bytes as well as in characters
+ * and, if @result was created with %TRANSLIT_RESULT_ALIGNMENT, with
+ * the spans of @input which each span of the output comes from.
+ *
+ * Results are not cached, since the cache does not keep the
+ * alignment; with @result %NULL, this is the same as
+ * translit_transliterator_transliterate_append().
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+translit_transliterator_transliterate_full (TranslitTransliterator *transliterator,
+					    const gchar            *input,
+					    gssize                  len,
+					    GString                *output,
+					    TranslitResult         *result,
+					    GError                **error)
+{
+  guint64 start;
+  gsize offset;
+  gssize n_chars;
+  gboolean retval;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), FALSE);
+  g_return_val_if_fail (input != NULL || len == 0, FALSE);
+  g_return_val_if_fail (output != NULL, FALSE);
+
+  if (result == NULL)
+    return translit_transliterator_transliterate_append (transliterator,
+							 input, len,
+							 output,
+							 NULL,
+							 error);
+
+  start = stats_begin ();
+  offset = output->len;
+  _translit_result_reset (result);
+
+  TRANSLIT_TRACE_BEGIN ("transliterate");
+  retval = check_input (transliterator, input, &len, &n_chars, error);
+  if (retval)
+    {
+      TRANSLIT_TRACE_BEGIN ("backend");
+      retval = TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator)->
+	transliterate_full (transliterator, input, len, n_chars,
+			    output, NULL, result, error);
+      TRANSLIT_TRACE_END ();
+    }
+  TRANSLIT_TRACE_END ();
+
+  if (!retval)
+    {
+      g_string_truncate (output, offset);
+      _translit_result_reset (result);
+    }
+  stats_end (transliterator, start,
+	     len,
+	     retval ? output->len - offset : 0,
+	     retval);
+
+  return retval;
+}
+
+/* Don't bother splitting pieces smaller than this.  */
+#define MIN_PARALLEL_CHUNK_SIZE (64 * 1024)
+
+typedef struct _ParallelChunk ParallelChunk;
+
+struct _ParallelChunk
+{
+  const gchar *input;
+  gsize len;
+  GString *output;
+  guint endpos;
+  GError *error;
+};
+
+/* The pieces of a parallel call, which the workers take in turn.  */
+typedef struct _ParallelJob ParallelJob;
+
+struct _ParallelJob
+{
+  GArray *chunks;
+  TranslitPool *pool;
+  volatile gint next_chunk;
+
+  GMutex mutex;
+  GCond cond;
+  guint n_running;
+};
+
+/* Threads shared by all the parallel calls, created on first use.  */
+static GThreadPool *parallel_threads = NULL;
+
+static gsize
+find_split (const gchar        *text,
+	    gsize               len,
+	    gsize               target,
+	    TranslitSplitPolicy policy)
+{
+  gsize length, i;
+
+  if (len <= target)
+    return len;
+
+  length = _translit_find_boundary (text, target, policy);
+  if (length > 0)
+    return length;
+
+  /* No boundary before TARGET; take the first one after it.  */
+  for (i = target; i < len; i++)
+    if (text[i] == '\n'
+	|| (policy == TRANSLIT_SPLIT_WHITESPACE && g_ascii_isspace (text[i])))
+      return i + 1;
+
+  return len;
+}
+
+/* Transliterate the pieces of JOB which are not taken yet, with an
+ * instance checked out of the pool of JOB.  */
+static void
+parallel_job_run (ParallelJob *job)
+{
+  TranslitTransliterator *transliterator = NULL;
+  GError *error = NULL;
+  gint i;
+
+  while ((i = g_atomic_int_add (&job->next_chunk, 1)) < (gint) job->chunks->len)
+    {
+      ParallelChunk *chunk = &g_array_index (job->chunks, ParallelChunk, i);
 
-  if (g_type_is_a (transliterator_type, G_TYPE_INITABLE))
-    {
-      transliterator = g_initable_newv (transliterator_type,
-					G_N_ELEMENTS (transliterator_parameters),
-					transliterator_parameters,
-					NULL,
-					error);
       if (transliterator == NULL)
 	{
-	  g_free (transliterator_id);
-	  return NULL;
+	  transliterator = translit_pool_acquire (job->pool, &error);
+	  if (transliterator == NULL)
+	    {
+	      chunk->error = error;
+	      error = NULL;
+	      continue;
+	    }
+	}
+
+      chunk->output = g_string_sized_new (chunk->len);
+      call_transliterate (transliterator,
+			  chunk->input, chunk->len, -1,
+			  chunk->output,
+			  &chunk->endpos,
+			  &chunk->error);
+    }
+
+  if (transliterator)
+    translit_pool_release (job->pool, transliterator);
+}
+
+static void
+parallel_worker_func (gpointer data, gpointer user_data)
+{
+  ParallelJob *job = data;
+
+  parallel_job_run (job);
+
+  g_mutex_lock (&job->mutex);
+  job->n_running--;
+  g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->mutex);
+}
+
+/**
+ * translit_transliterator_transliterate_parallel:
+ * @transliterator: a #TranslitTransliterator
+ * @input: (array length=len) (element-type guint8): an input string in UTF-8
+ * @len: the length of @input in bytes, or -1 if @input is nul-terminated
+ * @policy: where @input may be split
+ * @n_threads: the number of threads, or 0 to use one per processor
+ * @endpos: (out) (allow-none): ending position of transliteration (in chars)
+ * @error: a #GError
+ *
+ * Transliterate a large input using multiple threads.  @input is
+ * split into pieces at the boundaries allowed by @policy, where the
+ * transliterator is expected to keep no context, and each piece is
+ * transliterated by a separate instance of @transliterator.  If the
+ * backend is not thread-safe (see
+ * %TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE), @input is
+ * transliterated in the calling thread instead.
+ *
+ * Returns: a newly allocated output string
+ */
+gchar *
+translit_transliterator_transliterate_parallel (TranslitTransliterator *transliterator,
+						const gchar            *input,
+						gssize                  len,
+						TranslitSplitPolicy     policy,
+						guint                   n_threads,
+						guint                  *endpos,
+						GError                **error)
+{
+  TranslitTransliteratorPrivate *priv;
+  GArray *chunks;
+  ParallelJob job;
+  GString *output;
+  gsize offset, target, total_len = 0;
+  gssize n_input_chars;
+  guint i;
+  guint64 start;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  g_return_val_if_fail (input != NULL || len == 0, NULL);
+
+  priv = transliterator->priv;
+  start = stats_begin ();
+
+  if (!check_input (transliterator, input, &len, &n_input_chars, error))
+    {
+      stats_end (transliterator, start, len, 0, FALSE);
+      return NULL;
+    }
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  /* Make a few pieces per thread, so that threads which get easy
+   * pieces can help the others.  */
+  target = MAX (len / (n_threads * 4), MIN_PARALLEL_CHUNK_SIZE);
+  if (n_threads == 1 || len <= target
+      || (translit_transliterator_get_flags (transliterator)
+	  & TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE))
+    {
+      output = g_string_sized_new (len);
+      if (!call_transliterate (transliterator, input, len, n_input_chars,
+			       output,
+			       endpos,
+			       error))
+	{
+	  stats_end (transliterator, start, len, 0, FALSE);
+	  g_string_free (output, TRUE);
+	  return NULL;
+	}
+      stats_end (transliterator, start, len, output->len, TRUE);
+      return g_string_free (output, FALSE);
+    }
+
+  chunks = g_array_new (FALSE, TRUE, sizeof (ParallelChunk));
+  for (offset = 0; offset < (gsize) len; )
+    {
+      ParallelChunk chunk = { 0, };
+
+      chunk.input = input + offset;
+      chunk.len = find_split (chunk.input, len - offset, target, policy);
+      g_array_append_val (chunks, chunk);
+      offset += chunk.len;
+    }
+
+  G_LOCK (pool);
+  if (priv->pool == NULL)
+    priv->pool = _translit_pool_new_weak (transliterator, 0);
+
+  if (parallel_threads == NULL)
+    parallel_threads = g_thread_pool_new (parallel_worker_func,
+					  NULL,
+					  -1,
+					  FALSE,
+					  NULL);
+  G_UNLOCK (pool);
+
+  job.chunks = chunks;
+  job.pool = priv->pool;
+  job.next_chunk = 0;
+  g_mutex_init (&job.mutex);
+  g_cond_init (&job.cond);
+
+  /* The calling thread is one of the workers.  */
+  job.n_running = MIN (n_threads, chunks->len) - 1;
+  for (i = 0; i < job.n_running; i++)
+    g_thread_pool_push (parallel_threads, &job, NULL);
+  parallel_job_run (&job);
+
+  /* Wait until all the pieces are processed.  */
+  g_mutex_lock (&job.mutex);
+  while (job.n_running > 0)
+    g_cond_wait (&job.cond, &job.mutex);
+  g_mutex_unlock (&job.mutex);
+  g_mutex_clear (&job.mutex);
+  g_cond_clear (&job.cond);
+
+  output = NULL;
+  for (i = 0; i < chunks->len; i++)
+    {
+      ParallelChunk *chunk = &g_array_index (chunks, ParallelChunk, i);
+
+      if (chunk->error)
+	{
+	  g_propagate_error (error, chunk->error);
+	  chunk->error = NULL;
+	  goto out;
+	}
+      total_len += chunk->output->len;
+    }
+
+  output = g_string_sized_new (total_len);
+  for (i = 0; i < chunks->len; i++)
+    {
+      ParallelChunk *chunk = &g_array_index (chunks, ParallelChunk, i);
+
+      g_string_append_len (output, chunk->output->str, chunk->output->len);
+    }
+
+  /* The pieces are split where no context is kept, so only the last
+   * one may end with characters which are not fully transliterated.
+   * Adding up the positions reported by the backend keeps them in its
+   * own unit (e.g. UTF-16 code units for ICU), as in a serial call.  */
+  if (endpos)
+    {
+      *endpos = 0;
+      for (i = 0; i < chunks->len; i++)
+	*endpos += g_array_index (chunks, ParallelChunk, i).endpos;
+    }
+
+ out:
+  for (i = 0; i < chunks->len; i++)
+    {
+      ParallelChunk *chunk = &g_array_index (chunks, ParallelChunk, i);
+
+      if (chunk->output)
+	g_string_free (chunk->output, TRUE);
+      g_clear_error (&chunk->error);
+    }
+  g_array_free (chunks, TRUE);
+
+  stats_end (transliterator, start,
+	     len, output ? output->len : 0,
+	     output != NULL);
+
+  return output ? g_string_free (output, FALSE) : NULL;
+}
+
+/* Transliterate the N_INPUTS strings of INPUTS into OUTPUTS and
+ * ENDPOS, which are allocated by the caller, with the arena variant
+ * of the backend if ARENA is given.  */
+static gboolean
+transliterate_batch (TranslitTransliterator *transliterator,
+		     const gchar * const    *inputs,
+		     gsize                   n_inputs,
+		     gchar                 **outputs,
+		     guint                  *endpos,
+		     TranslitArena          *arena,
+		     GError                **error)
+{
+  TranslitTransliteratorClass *klass =
+    TRANSLIT_TRANSLITERATOR_GET_CLASS (transliterator);
+  gsize i;
+  guint64 start;
+  gboolean retval;
+
+  start = stats_begin ();
+
+  for (i = 0; i < n_inputs && !transliterator->priv->trusted_input; i++)
+    if (!_translit_utf8_validate_count (inputs[i], -1, NULL, NULL))
+      {
+	g_set_error (error,
+		     TRANSLIT_ERROR,
+		     TRANSLIT_ERROR_INVALID_INPUT,
+		     "not a valid UTF-8 sequence at index %" G_GSIZE_FORMAT,
+		     i);
+	stats_end (transliterator, start, 0, 0, FALSE);
+	return FALSE;
+      }
+
+  TRANSLIT_TRACE_BEGIN ("backend");
+  retval = klass->transliterate_batch_arena (transliterator,
+					     inputs, n_inputs,
+					     outputs, endpos,
+					     arena,
+					     error);
+  TRANSLIT_TRACE_END ();
+
+  if (!retval)
+    {
+      stats_end (transliterator, start, 0, 0, FALSE);
+      return FALSE;
+    }
+
+#ifdef ENABLE_STATS
+  {
+    gsize input_bytes = 0, output_bytes = 0;
+
+    for (i = 0; i < n_inputs; i++)
+      {
+	input_bytes += strlen (inputs[i]);
+	output_bytes += strlen (outputs[i]);
+      }
+    stats_end (transliterator, start, input_bytes, output_bytes, TRUE);
+  }
+#endif
+
+  return TRUE;
+}
+
+/**
+ * translit_transliterator_transliterate_batch:
+ * @transliterator: a #TranslitTransliterator
+ * @inputs: (array length=n_inputs): input strings in UTF-8
+ * @n_inputs: the number of strings in @inputs, or -1 if @inputs is
+ * %NULL-terminated
+ * @endpos: (out) (allow-none) (transfer full): ending positions of
+ * transliteration (in chars), one per input; the array has as many
+ * elements as the returned array of outputs, also when @n_inputs is -1
+ * @error: a #GError
+ *
+ * Transliterate many strings in one call.  This is equivalent to
+ * calling translit_transliterator_transliterate() on each element of
+ * @inputs, but lets the backend reuse its scratch state across items.
+ *
+ * Returns: (array zero-terminated=1) (transfer full): a newly
+ * allocated %NULL-terminated array of output strings, or %NULL on error
+ */
+gchar **
+translit_transliterator_transliterate_batch (TranslitTransliterator *transliterator,
+                                             const gchar * const    *inputs,
+                                             gssize                  n_inputs,
+                                             guint                 **endpos,
+                                             GError                **error)
+{
+  gchar **outputs;
+  guint *_endpos;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  g_return_val_if_fail (inputs != NULL || n_inputs <= 0, NULL);
+
+  if (n_inputs < 0)
+    n_inputs = g_strv_length ((gchar **) inputs);
+
+  outputs = g_new0 (gchar *, n_inputs + 1);
+  _endpos = g_new0 (guint, n_inputs);
+
+  if (!transliterate_batch (transliterator, inputs, n_inputs,
+			    outputs, _endpos, NULL, error))
+    {
+      g_strfreev (outputs);
+      g_free (_endpos);
+      return NULL;
+    }
+
+  if (endpos)
+    *endpos = _endpos;
+  else
+    g_free (_endpos);
+
+  return outputs;
+}
+
+/**
+ * translit_transliterator_transliterate_batch_arena:
+ * @transliterator: a #TranslitTransliterator
+ * @inputs: (array length=n_inputs): input strings in UTF-8
+ * @n_inputs: the number of strings in @inputs, or -1 if @inputs is
+ * %NULL-terminated
+ * @endpos: (out) (allow-none) (transfer none): ending positions of
+ * transliteration (in chars), one per input; the array has as many
+ * elements as the returned array of outputs, also when @n_inputs is -1
+ * @arena: a #TranslitArena
+ * @error: a #GError
+ *
+ * Same as translit_transliterator_transliterate_batch(), except that
+ * the array, the output strings, @endpos and the scratch buffers of
+ * the backend are allocated from @arena, and released with it.
+ *
+ * Returns: (array zero-terminated=1) (transfer none): a
+ * %NULL-terminated array of output strings, or %NULL on error
+ */
+gchar **
+translit_transliterator_transliterate_batch_arena (TranslitTransliterator *transliterator,
+						   const gchar * const    *inputs,
+						   gssize                  n_inputs,
+						   guint                 **endpos,
+						   TranslitArena          *arena,
+						   GError                **error)
+{
+  gchar **outputs;
+  guint *_endpos;
+
+  g_return_val_if_fail (TRANSLIT_IS_TRANSLITERATOR (transliterator), NULL);
+  g_return_val_if_fail (inputs != NULL || n_inputs <= 0, NULL);
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  if (n_inputs < 0)
+    n_inputs = g_strv_length ((gchar **) inputs);
+
+  outputs = translit_arena_alloc (arena, (n_inputs + 1) * sizeof (gchar *));
+  memset (outputs, 0, (n_inputs + 1) * sizeof (gchar *));
+  _endpos = translit_arena_alloc (arena, n_inputs * sizeof (guint));
+  memset (_endpos, 0, n_inputs * sizeof (guint));
+
+  if (!transliterate_batch (transliterator, inputs, n_inputs,
+			    outputs, _endpos, arena, error))
+    return NULL;
+
+  if (endpos)
+    *endpos = _endpos;
+
+  return outputs;
+}
+
+#if !defined(G_OS_WIN32) && !defined(G_WITH_CYGWIN)
+#define MODULE_PREFIX "libtranslit"
+#define MODULE_SUFFIX ".so"
+#else
+#define MODULE_PREFIX "translit"
+#define MODULE_SUFFIX ".dll"
+#endif
+
+#define MODULE_CACHE_NAME "modules.cache"
+
+static gchar *
+build_module_filename (const gchar *name)
+{
+  return g_strconcat (MODULE_PREFIX, name, MODULE_SUFFIX, NULL);
+}
+
+/* Load the module in FILENAME, unless it is already loaded.  Must be
+ * called with LOAD_LOCK held.  */
+static TranslitModule *
+use_module (const gchar *filename)
+{
+  TranslitModule *module;
+  gboolean loaded;
+
+  module = g_hash_table_lookup (modules, filename);
+  if (module)
+    return module;
+
+  module = translit_module_new (filename);
+
+  loading_module = module;
+  loaded = g_type_module_use (G_TYPE_MODULE (module));
+  loading_module = NULL;
+
+  if (!loaded)
+    {
+      g_printerr ("Failed to load module: %s\n", filename);
+      g_object_unref (module);
+      return NULL;
+    }
+
+  g_hash_table_insert (modules, g_strdup (filename), module);
+  return module;
+}
+
+/* Return TRUE if the file of A was not modified before that of B,
+ * with the nanoseconds where they are available.  A cache and its
+ * directory are usually stamped with the same clock tick when the
+ * cache is written, so equal times must be accepted.  */
+static gboolean
+stat_is_not_older (const GStatBuf *a, const GStatBuf *b)
+{
+  if (a->st_mtime != b->st_mtime)
+    return a->st_mtime > b->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  return a->st_mtim.tv_nsec >= b->st_mtim.tv_nsec;
+#else
+  return TRUE;
+#endif
+}
+
+/* Return the module cache of DIRECTORY, or NULL if it has none or
+ * the cache is older than the directory, i.e. modules have been
+ * added or removed since it was generated.  Must be called with
+ * LOAD_LOCK held.  */
+static GKeyFile *
+get_module_cache (const gchar *directory)
+{
+  GKeyFile *cache = NULL;
+  gpointer data;
+  GStatBuf dir_stat, cache_stat;
+  gchar *filename;
+
+  if (g_hash_table_lookup_extended (module_caches, directory, NULL, &data))
+    return data;
+
+  filename = g_build_filename (directory, MODULE_CACHE_NAME, NULL);
+  if (g_stat (directory, &dir_stat) == 0
+      && g_stat (filename, &cache_stat) == 0
+      && stat_is_not_older (&cache_stat, &dir_stat))
+    {
+      cache = g_key_file_new ();
+      if (!g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, NULL))
+	{
+	  g_key_file_free (cache);
+	  cache = NULL;
+	}
+    }
+  g_free (filename);
+
+  g_hash_table_insert (module_caches, g_strdup (directory), cache);
+  return cache;
+}
+
+/* Register the backends linked into the library, if any.  Must be
+ * called with LOAD_LOCK held.  */
+static void
+load_builtin_modules (void)
+{
+#if defined(BUILTIN_ICU) || defined(BUILTIN_M17N)
+  static TranslitModule *module = NULL;
+
+  if (module)
+    return;
+
+  module = g_object_new (TRANSLIT_TYPE_MODULE, NULL);
+  module->load = builtin_module_load;
+  module->unload = builtin_module_unload;
+  loading_module = module;
+  g_type_module_use (G_TYPE_MODULE (module));
+  loading_module = NULL;
+#endif
+}
+
+static void
+load_module (const gchar **paths, const char *backend)
+{
+  gchar *module_filename;
+
+  if (!g_module_supported ())
+    return;
+
+  TRANSLIT_TRACE_BEGIN ("load_module");
+  module_filename = build_module_filename (backend);
+
+  for (; *paths; paths++)
+    {
+      GKeyFile *cache;
+      gchar *name, *path;
+
+      /* A valid cache lists every backend implemented in the
+       * directory, so no other file needs to be looked at.  */
+      cache = get_module_cache (*paths);
+      if (cache)
+	{
+	  name = g_key_file_get_string (cache, backend, "Module", NULL);
+	  if (name == NULL)
+	    continue;
 	}
+      else
+	name = g_strdup (module_filename);
+
+      path = g_build_filename (*paths, name, NULL);
+      g_free (name);
+
+      if (cache || g_file_test (path, G_FILE_TEST_IS_REGULAR))
+	use_module (path);
+      g_free (path);
+
+      if (g_hash_table_lookup (transliterator_types, backend))
+	break;
+    }
+  g_free (module_filename);
+  TRANSLIT_TRACE_END ();
+}
+
+/**
+ * translit_update_module_cache:
+ * @directory: a module directory
+ * @error: a #GError
+ *
+ * Load all the modules in @directory and write the names of the
+ * backends they implement into the module cache of @directory, so
+ * that translit_transliterator_get() can find the module of a
+ * backend without looking at the other files.  This is usually done
+ * by the translit-query-modules program when modules are installed.
+ *
+ * Returns: %TRUE if the cache was written, %FALSE otherwise
+ */
+gboolean
+translit_update_module_cache (const gchar *directory,
+			      GError     **error)
+{
+  GKeyFile *cache;
+  GDir *dir;
+  const gchar *name;
+  gchar *filename, *data;
+  gsize length;
+  gboolean retval;
+
+  g_return_val_if_fail (directory != NULL, FALSE);
+
+  registry_init ();
+
+  dir = g_dir_open (directory, 0, error);
+  if (dir == NULL)
+    return FALSE;
+
+  cache = g_key_file_new ();
+  g_key_file_set_comment (cache, NULL, NULL,
+			  " Generated by translit-query-modules; do not edit.",
+			  NULL);
+
+  g_rec_mutex_lock (&load_lock);
+  while ((name = g_dir_read_name (dir)))
+    {
+      TranslitModule *module;
+      GSList *l;
+
+      if (!g_str_has_prefix (name, MODULE_PREFIX)
+	  || !g_str_has_suffix (name, MODULE_SUFFIX))
+	continue;
+
+      filename = g_build_filename (directory, name, NULL);
+      module = g_module_supported () ? use_module (filename) : NULL;
+      g_free (filename);
+
+      if (module)
+	for (l = module->backends; l; l = l->next)
+	  g_key_file_set_string (cache, l->data, "Module", name);
+    }
+  g_hash_table_remove (module_caches, directory);
+  g_rec_mutex_unlock (&load_lock);
+  g_dir_close (dir);
+
+  data = g_key_file_to_data (cache, &length, NULL);
+  g_key_file_free (cache);
+
+  filename = g_build_filename (directory, MODULE_CACHE_NAME, NULL);
+  retval = g_file_set_contents (filename, data, length, error);
+
+  /* Writing the cache changed the mtime of the directory, possibly
+   * to a later time than that of the cache itself.  */
+  if (retval)
+    g_utime (filename, NULL);
+
+  g_free (filename);
+  g_free (data);
+
+  return retval;
+}
+
+static TranslitTransliterator *
+create_transliterator (const gchar *backend,
+		       const gchar *name,
+		       const gchar *transliterator_id,
+		       GError     **error)
+{
+  GType transliterator_type;
+  TranslitTransliterator *transliterator = NULL;
+  GParameter transliterator_parameters[1] = {
+    { "name", { 0 } }
+  };
+  gpointer data;
+
+  data = g_hash_table_lookup (transliterator_types, backend);
+  if (data == NULL)
+    {
+      load_builtin_modules ();
+      data = g_hash_table_lookup (transliterator_types, backend);
+    }
+
+  if (data == NULL)
+    {
+      const gchar *module_path;
+      gchar **paths;
+      gchar *default_paths[] = { MODULEDIR, NULL };
+
+      module_path = g_getenv ("TRANSLIT_MODULE_PATH");
+      if (module_path)
+	paths = g_strsplit (module_path, G_SEARCHPATH_SEPARATOR_S, 0);
+      else
+	paths = g_strdupv (default_paths);
+      load_module ((const gchar **) paths, backend);
+      g_strfreev (paths);
+    }
+
+  data = g_hash_table_lookup (transliterator_types, backend);
+  if (data == NULL)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_NO_SUCH_BACKEND,
+		   "no such backend %s",
+		   backend);
+      return NULL;
+    }
+
+  transliterator_type = GPOINTER_TO_SIZE (data);
+  g_value_init (&transliterator_parameters[0].value, G_TYPE_STRING);
+  g_value_set_string (&transliterator_parameters[0].value, name);
+
+  if (g_type_is_a (transliterator_type, G_TYPE_INITABLE))
+    {
+      TRANSLIT_TRACE_BEGIN ("initable_init");
+      transliterator = g_initable_newv (transliterator_type,
+					G_N_ELEMENTS (transliterator_parameters),
+					transliterator_parameters,
+					NULL,
+					error);
+      TRANSLIT_TRACE_END ();
     }
   else
     transliterator = g_object_newv (transliterator_type,
 				    G_N_ELEMENTS (transliterator_parameters),
 				    transliterator_parameters);
+  g_value_unset (&transliterator_parameters[0].value);
 
-  if (transliterators == NULL)
-    transliterators = g_hash_table_new_full (g_str_hash,
-					     g_str_equal,
-					     (GDestroyNotify) g_free,
-					     NULL);
-  g_hash_table_insert (transliterators, g_strdup (transliterator_id), transliterator);
+  if (transliterator == NULL)
+    return NULL;
+
+  g_rw_lock_writer_lock (&registry_lock);
+  g_hash_table_insert (transliterators,
+		       g_strdup (transliterator_id),
+		       transliterator);
+  g_hash_table_insert (transliterators_by_id,
+		       GUINT_TO_POINTER (g_quark_from_string (transliterator_id)),
+		       transliterator);
+  g_rw_lock_writer_unlock (&registry_lock);
+
+  return transliterator;
+}
+
+/**
+ * translit_transliterator_get:
+ * @backend: backend name (e.g. "m17n")
+ * @name: name of the transliterator (e.g. "hi-inscript")
+ * @error: a #GError
+ *
+ * Get a transliterator instance whose name is @name.  This function
+ * is thread-safe; a transliterator is created only once, even if
+ * requested from several threads at the same time.
+ *
+ * Returns: (transfer none): a #TranslitTransliterator
+ */
+TranslitTransliterator *
+translit_transliterator_get (const gchar *backend,
+			     const gchar *name,
+			     GError     **error)
+{
+  gchar buffer[64], *transliterator_id;
+  TranslitTransliterator *transliterator;
+
+  g_return_val_if_fail (backend != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  registry_init ();
+
+  TRANSLIT_TRACE_BEGIN ("translit_transliterator_get");
+
+  /* Avoid allocating the key for the common, short names.  */
+  transliterator_id = buffer;
+  if ((gsize) g_snprintf (buffer, sizeof (buffer), "%s:%s", backend, name)
+      >= sizeof (buffer))
+    transliterator_id = g_strdup_printf ("%s:%s", backend, name);
+
+  g_rw_lock_reader_lock (&registry_lock);
+  transliterator = g_hash_table_lookup (transliterators, transliterator_id);
+  g_rw_lock_reader_unlock (&registry_lock);
+
+  if (transliterator == NULL)
+    {
+      g_rec_mutex_lock (&load_lock);
+
+      /* Check again, since another thread might have created it
+       * while we were waiting for the lock.  */
+      g_rw_lock_reader_lock (&registry_lock);
+      transliterator = g_hash_table_lookup (transliterators,
+					    transliterator_id);
+      g_rw_lock_reader_unlock (&registry_lock);
+
+      if (transliterator == NULL)
+	transliterator = create_transliterator (backend,
+						name,
+						transliterator_id,
+						error);
+      g_rec_mutex_unlock (&load_lock);
+    }
+
+  if (transliterator_id != buffer)
+    g_free (transliterator_id);
+
+  TRANSLIT_TRACE_END ();
+
+  return transliterator;
+}
+
+/**
+ * translit_transliterator_id:
+ * @backend: backend name (e.g. "m17n")
+ * @name: name of the transliterator (e.g. "hi-inscript")
+ *
+ * Get an interned identifier of the transliterator whose name is
+ * @name, to be used with translit_transliterator_get_by_id().
+ *
+ * Returns: a #GQuark identifying the transliterator
+ */
+GQuark
+translit_transliterator_id (const gchar *backend,
+			    const gchar *name)
+{
+  gchar *transliterator_id;
+  GQuark id;
+
+  g_return_val_if_fail (backend != NULL, 0);
+  g_return_val_if_fail (name != NULL, 0);
+
+  transliterator_id = g_strdup_printf ("%s:%s", backend, name);
+  id = g_quark_from_string (transliterator_id);
   g_free (transliterator_id);
+
+  return id;
+}
+
+/**
+ * translit_transliterator_get_by_id:
+ * @id: an identifier returned by translit_transliterator_id()
+ * @error: a #GError
+ *
+ * Same as translit_transliterator_get(), but takes a pre-computed
+ * identifier, so that looking up an existing transliterator involves
+ * neither string formatting nor string hashing.
+ *
+ * Returns: (transfer none): a #TranslitTransliterator
+ */
+TranslitTransliterator *
+translit_transliterator_get_by_id (GQuark   id,
+				   GError **error)
+{
+  TranslitTransliterator *transliterator;
+  const gchar *transliterator_id, *colon;
+  gchar *backend;
+
+  g_return_val_if_fail (id != 0, NULL);
+
+  registry_init ();
+
+  g_rw_lock_reader_lock (&registry_lock);
+  transliterator = g_hash_table_lookup (transliterators_by_id,
+					GUINT_TO_POINTER (id));
+  g_rw_lock_reader_unlock (&registry_lock);
+
+  if (transliterator != NULL)
+    return transliterator;
+
+  transliterator_id = g_quark_to_string (id);
+  colon = strchr (transliterator_id, ':');
+  g_return_val_if_fail (colon != NULL, NULL);
+
+  backend = g_strndup (transliterator_id, colon - transliterator_id);
+  transliterator = translit_transliterator_get (backend, colon + 1, error);
+  g_free (backend);
+
   return transliterator;
 }
 
+/**
+ * translit_transliterator_dump_stats:
+ * @histogram: whether to include the latency histograms
+ *
+ * Format the statistics of all the transliterators created with
+ * translit_transliterator_get(), one transliterator per line, as
+ * "backend:name key=value...".  With @histogram, each line ends with
+ * "histogram=N:COUNT,...", listing the non-empty buckets.
+ *
+ * Returns: a newly allocated string
+ */
+gchar *
+translit_transliterator_dump_stats (gboolean histogram)
+{
+  GString *dump;
+  GList *ids, *l;
+
+  registry_init ();
+
+  dump = g_string_new (NULL);
+
+  g_rw_lock_reader_lock (&registry_lock);
+  ids = g_list_sort (g_hash_table_get_keys (transliterators),
+		     (GCompareFunc) strcmp);
+  for (l = ids; l; l = l->next)
+    {
+      TranslitTransliterator *transliterator;
+      TranslitTransliteratorStats stats;
+
+      transliterator = g_hash_table_lookup (transliterators, l->data);
+      translit_transliterator_get_stats (transliterator, &stats);
+
+      g_string_append_printf (dump,
+			      "%s"
+			      " calls=%" G_GUINT64_FORMAT
+			      " input_bytes=%" G_GUINT64_FORMAT
+			      " output_bytes=%" G_GUINT64_FORMAT
+			      " total_ns=%" G_GUINT64_FORMAT
+			      " max_ns=%" G_GUINT64_FORMAT
+			      " errors=%" G_GUINT64_FORMAT
+			      " retries=%" G_GUINT64_FORMAT,
+			      (const gchar *) l->data,
+			      stats.calls,
+			      stats.input_bytes,
+			      stats.output_bytes,
+			      stats.total_ns,
+			      stats.max_ns,
+			      stats.errors,
+			      stats.retries);
+      if (histogram)
+	{
+	  const gchar *separator = " histogram=";
+	  gint i;
+
+	  for (i = 0; i < TRANSLIT_STATS_HISTOGRAM_SIZE; i++)
+	    if (stats.histogram[i] > 0)
+	      {
+		g_string_append_printf (dump, "%s%d:%" G_GUINT64_FORMAT,
+					separator, i, stats.histogram[i]);
+		separator = ",";
+	      }
+	}
+      g_string_append_c (dump, '\n');
+    }
+  g_rw_lock_reader_unlock (&registry_lock);
+  g_list_free (ids);
+
+  return g_string_free (dump, FALSE);
+}
+
 void
 translit_implement_transliterator (const gchar *backend, GType type)
 {
+  registry_init ();
+
+  g_rec_mutex_lock (&load_lock);
   g_hash_table_insert (transliterator_types,
 		       g_strdup (backend),
 		       GSIZE_TO_POINTER (type));
+  if (loading_module)
+    loading_module->backends = g_slist_prepend (loading_module->backends,
+						g_strdup (backend));
+  g_rec_mutex_unlock (&load_lock);
 }
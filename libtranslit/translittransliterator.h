@@ -20,6 +20,8 @@
 #define __TRANSLIT_TRANSLITERATOR_H__
 
 #include <glib-object.h>
+#include <libtranslit/translitresult.h>
+#include <libtranslit/translitarena.h>
 
 G_BEGIN_DECLS
 
@@ -34,6 +36,40 @@ typedef struct _TranslitTransliterator TranslitTransliterator;
 typedef struct _TranslitTransliteratorClass TranslitTransliteratorClass;
 typedef struct _TranslitTransliteratorPrivate TranslitTransliteratorPrivate;
 
+/**
+ * TranslitTransliteratorFlags:
+ * @TRANSLIT_TRANSLITERATOR_FLAGS_NONE: no flags
+ * @TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE: the output for the same
+ * input may differ between calls, so it must not be cached
+ * @TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS: the output does
+ * not depend on the context across whitespace, punctuation, or script
+ * changes, so words can be transliterated separately
+ * @TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE: the backend library
+ * keeps global state, so even separate instances must not be used
+ * from several threads at the same time
+ *
+ * Properties of a transliterator, declared by the backend.
+ */
+typedef enum {
+  TRANSLIT_TRANSLITERATOR_FLAGS_NONE = 0,
+  TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE = 1 << 0,
+  TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS = 1 << 1,
+  TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE = 1 << 2
+} TranslitTransliteratorFlags;
+
+/**
+ * TranslitCacheMode:
+ * @TRANSLIT_CACHE_INPUT: cache the result for each input
+ * @TRANSLIT_CACHE_TOKENS: split the input into words and cache the
+ * result for each word
+ *
+ * What is cached by translit_transliterator_set_cache_size().
+ */
+typedef enum {
+  TRANSLIT_CACHE_INPUT,
+  TRANSLIT_CACHE_TOKENS
+} TranslitCacheMode;
+
 struct _TranslitTransliterator
 {
   /*< private >*/
@@ -42,16 +78,79 @@ struct _TranslitTransliterator
   TranslitTransliteratorPrivate *priv;
 };
 
+/**
+ * TranslitTransliteratorClass:
+ * @transliterate: transliterate a valid UTF-8 input, appending to the
+ * output; by default, this calls @transliterate_full
+ * @transliterate_batch: transliterate several nul-terminated inputs;
+ * by default, this calls @transliterate_batch_arena
+ * @create_session: create a #TranslitSession
+ * @clone: create a new instance, sharing what the backend can share
+ * @would_change: whether the input may be modified
+ * @get_flags: get the #TranslitTransliteratorFlags
+ * @transliterate_full: like @transliterate, also given the number of
+ * characters in the input (or -1 if it is not known), and filling
+ * the #TranslitResult if not %NULL; by default, this calls
+ * @transliterate and maps the whole input to the whole output
+ * @transliterate_batch_arena: like @transliterate_batch, allocating
+ * the outputs from a #TranslitArena if not %NULL; by default, this
+ * calls @transliterate_full for each input
+ *
+ * A backend implements at least one of @transliterate and
+ * @transliterate_full, and may implement @transliterate_batch_arena
+ * if it can do better than one call per input.  Of each pair, only
+ * @transliterate_full and @transliterate_batch_arena are called by
+ * libtranslit itself; the others are kept for the backends which
+ * implement them.
+ */
 struct _TranslitTransliteratorClass
 {
   /*< private >*/
   GObjectClass parent_class;
 
   /*< public >*/
-  gchar *(*transliterate) (TranslitTransliterator *transliterator,
-                           const gchar            *input,
-                           guint                  *endpos,
-                           GError                **error);
+  gboolean (*transliterate) (TranslitTransliterator *transliterator,
+                             const gchar            *input,
+                             gsize                   len,
+                             GString                *output,
+                             guint                  *endpos,
+                             GError                **error);
+  gboolean (*transliterate_batch) (TranslitTransliterator *transliterator,
+                                   const gchar * const    *inputs,
+                                   gsize                   n_inputs,
+                                   gchar                 **outputs,
+                                   guint                  *endpos,
+                                   GError                **error);
+  struct _TranslitSession *(*create_session)
+                                  (TranslitTransliterator *transliterator);
+  TranslitTransliterator *(*clone) (TranslitTransliterator *transliterator,
+                                    GError                **error);
+  gboolean (*would_change) (TranslitTransliterator *transliterator,
+                            const gchar            *input,
+                            gsize                   len);
+  TranslitTransliteratorFlags (*get_flags)
+                                  (TranslitTransliterator *transliterator);
+  gboolean (*transliterate_full)
+                            (TranslitTransliterator *transliterator,
+                             const gchar            *input,
+                             gsize                   len,
+                             gssize                  n_chars,
+                             GString                *output,
+                             guint                  *endpos,
+                             TranslitResult         *result,
+                             GError                **error);
+  gboolean (*transliterate_batch_arena)
+                            (TranslitTransliterator *transliterator,
+                             const gchar * const    *inputs,
+                             gsize                   n_inputs,
+                             gchar                 **outputs,
+                             guint                  *endpos,
+                             TranslitArena          *arena,
+                             GError                **error);
+
+  /*< private >*/
+  /* Padding for future expansion.  */
+  gpointer padding[8];
 };
 
 GQuark translit_error_quark (void);
@@ -64,6 +163,58 @@ typedef enum {
   TRANSLIT_ERROR_FAILED
 } TranslitErrorEnum;
 
+/**
+ * TranslitSplitPolicy:
+ * @TRANSLIT_SPLIT_LINE: split only after a newline
+ * @TRANSLIT_SPLIT_WHITESPACE: split after a newline or a whitespace
+ *
+ * Where an input may be split into pieces which are transliterated
+ * independently.
+ */
+typedef enum {
+  TRANSLIT_SPLIT_LINE,
+  TRANSLIT_SPLIT_WHITESPACE
+} TranslitSplitPolicy;
+
+/**
+ * TRANSLIT_STATS_HISTOGRAM_SIZE:
+ *
+ * The number of buckets in the latency histogram of
+ * #TranslitTransliteratorStats.
+ */
+#define TRANSLIT_STATS_HISTOGRAM_SIZE 32
+
+typedef struct _TranslitTransliteratorStats TranslitTransliteratorStats;
+
+/**
+ * TranslitTransliteratorStats:
+ * @calls: the number of transliteration calls
+ * @input_bytes: the total length of the inputs
+ * @output_bytes: the total length of the outputs
+ * @total_ns: the total time spent in the calls, in nanoseconds
+ * @max_ns: the time spent in the slowest call, in nanoseconds
+ * @errors: the number of calls which failed
+ * @retries: the number of times the backend had to enlarge its
+ * buffers in the middle of a call
+ * @histogram: the number of calls by latency; bucket N counts the
+ * calls which took [2^N, 2^(N+1)) nanoseconds, and the last bucket
+ * also counts the slower ones
+ *
+ * The statistics of a transliterator, returned by
+ * translit_transliterator_get_stats().
+ */
+struct _TranslitTransliteratorStats
+{
+  guint64 calls;
+  guint64 input_bytes;
+  guint64 output_bytes;
+  guint64 total_ns;
+  guint64 max_ns;
+  guint64 errors;
+  guint64 retries;
+  guint64 histogram[TRANSLIT_STATS_HISTOGRAM_SIZE];
+};
+
 GType                   translit_transliterator_get_type
                         (void) G_GNUC_CONST;
 gchar                  *translit_transliterator_transliterate
@@ -71,14 +222,98 @@ gchar                  *translit_transliterator_transliterate
                          const gchar            *input,
                          guint                  *endpos,
                          GError                **error);
+gboolean                translit_transliterator_transliterate_append
+                        (TranslitTransliterator *transliterator,
+                         const gchar            *input,
+                         gssize                  len,
+                         GString                *output,
+                         guint                  *endpos,
+                         GError                **error);
+gboolean                translit_transliterator_transliterate_full
+                        (TranslitTransliterator *transliterator,
+                         const gchar            *input,
+                         gssize                  len,
+                         GString                *output,
+                         TranslitResult         *result,
+                         GError                **error);
+gchar                  *translit_transliterator_transliterate_parallel
+                        (TranslitTransliterator *transliterator,
+                         const gchar            *input,
+                         gssize                  len,
+                         TranslitSplitPolicy     policy,
+                         guint                   n_threads,
+                         guint                  *endpos,
+                         GError                **error);
+gchar                 **translit_transliterator_transliterate_batch
+                        (TranslitTransliterator *transliterator,
+                         const gchar * const    *inputs,
+                         gssize                  n_inputs,
+                         guint                 **endpos,
+                         GError                **error);
+gchar                  *translit_transliterator_transliterate_arena
+                        (TranslitTransliterator *transliterator,
+                         const gchar            *input,
+                         gssize                  len,
+                         guint                  *endpos,
+                         TranslitArena          *arena,
+                         GError                **error);
+gchar                 **translit_transliterator_transliterate_batch_arena
+                        (TranslitTransliterator *transliterator,
+                         const gchar * const    *inputs,
+                         gssize                  n_inputs,
+                         guint                 **endpos,
+                         TranslitArena          *arena,
+                         GError                **error);
+TranslitTransliterator *translit_transliterator_clone
+                        (TranslitTransliterator *transliterator,
+                         GError                **error);
+gboolean                translit_transliterator_would_change
+                        (TranslitTransliterator *transliterator,
+                         const gchar            *input,
+                         gssize                  len);
+TranslitTransliteratorFlags
+                        translit_transliterator_get_flags
+                        (TranslitTransliterator *transliterator);
+void                    translit_transliterator_set_cache_size
+                        (TranslitTransliterator *transliterator,
+                         guint                   max_entries,
+                         gsize                   max_bytes);
+void                    translit_transliterator_set_cache_mode
+                        (TranslitTransliterator *transliterator,
+                         TranslitCacheMode       mode);
+void                    translit_transliterator_set_trusted_input
+                        (TranslitTransliterator *transliterator,
+                         gboolean                trusted);
+void                    translit_transliterator_get_cache_stats
+                        (TranslitTransliterator *transliterator,
+                         guint64                *hits,
+                         guint64                *misses);
+void                    translit_transliterator_get_stats
+                        (TranslitTransliterator *transliterator,
+                         TranslitTransliteratorStats
+                                                *stats);
+void                    translit_transliterator_add_retries
+                        (TranslitTransliterator *transliterator,
+                         guint                   n_retries);
+gchar                  *translit_transliterator_dump_stats
+                        (gboolean                histogram);
 
 TranslitTransliterator *translit_transliterator_get
                         (const gchar            *backend,
                          const gchar            *name,
                          GError                **error);
+GQuark                  translit_transliterator_id
+                        (const gchar            *backend,
+                         const gchar            *name);
+TranslitTransliterator *translit_transliterator_get_by_id
+                        (GQuark                  id,
+                         GError                **error);
 void                    translit_implement_transliterator
                         (const gchar            *backend,
                          GType                   type);
+gboolean                translit_update_module_cache
+                        (const gchar            *directory,
+                         GError                **error);
 
 G_END_DECLS
 
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "translitprivate.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Each of the following returns the first byte in [P, END) which is
+ * either nul or not ASCII, or END.  No byte at or past END is read.  */
+typedef const guchar *(*SkipAsciiFunc) (const guchar *p, const guchar *end);
+
+#define IS_PLAIN_ASCII(c) ((c) != 0 && (c) < 0x80)
+
+static const guchar *
+skip_ascii_scalar (const guchar *p, const guchar *end)
+{
+  const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+  const guint64 highs = G_GUINT64_CONSTANT (0x8080808080808080);
+
+  while (((gsize) p & 7) != 0 && p < end)
+    {
+      if (!IS_PLAIN_ASCII (*p))
+	return p;
+      p++;
+    }
+
+  while (p + 8 <= end)
+    {
+      guint64 v;
+
+      memcpy (&v, p, sizeof (v));
+      /* the high bits, or the bytes which are zero */
+      if (((v | ((v - ones) & ~v)) & highs) != 0)
+	break;
+      p += 8;
+    }
+
+  while (p < end && IS_PLAIN_ASCII (*p))
+    p++;
+  return p;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__ ((target ("sse2")))
+static const guchar *
+skip_ascii_sse2 (const guchar *p, const guchar *end)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+
+  while (((gsize) p & 15) != 0 && p < end)
+    {
+      if (!IS_PLAIN_ASCII (*p))
+	return p;
+      p++;
+    }
+
+  while (p + 16 <= end)
+    {
+      __m128i v = _mm_load_si128 ((const __m128i *) p);
+      gint mask = _mm_movemask_epi8 (v)
+	| _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero));
+
+      if (mask != 0)
+	return p + __builtin_ctz (mask);
+      p += 16;
+    }
+
+  while (p < end && IS_PLAIN_ASCII (*p))
+    p++;
+  return p;
+}
+
+__attribute__ ((target ("avx2")))
+static const guchar *
+skip_ascii_avx2 (const guchar *p, const guchar *end)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+
+  while (((gsize) p & 31) != 0 && p < end)
+    {
+      if (!IS_PLAIN_ASCII (*p))
+	return p;
+      p++;
+    }
+
+  while (p + 32 <= end)
+    {
+      __m256i v = _mm256_load_si256 ((const __m256i *) p);
+      guint32 mask = (guint32) _mm256_movemask_epi8 (v)
+	| (guint32) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, zero));
+
+      if (mask != 0)
+	return p + __builtin_ctz (mask);
+      p += 32;
+    }
+
+  while (p < end && IS_PLAIN_ASCII (*p))
+    p++;
+  return p;
+}
+#endif
+
+static SkipAsciiFunc
+choose_skip_ascii (void)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return skip_ascii_avx2;
+  if (__builtin_cpu_supports ("sse2"))
+    return skip_ascii_sse2;
+#endif
+  return skip_ascii_scalar;
+}
+
+static inline gboolean
+is_continuation (guchar c)
+{
+  return (c & 0xC0) == 0x80;
+}
+
+/* Return the length of the valid, non-nul UTF-8 character at P, or 0.
+ * Overlong forms, surrogates and code points beyond U+10FFFF are
+ * invalid, as with g_utf8_validate().  A nul before END stops the
+ * checks, since it is not a continuation byte.  */
+static inline gsize
+decode_length (const guchar *p, const guchar *end)
+{
+  guchar c = p[0];
+
+  if (c < 0xC2)
+    return 0;
+
+  if (c < 0xE0)
+    {
+      if (end - p < 2 || !is_continuation (p[1]))
+	return 0;
+      return 2;
+    }
+
+  if (c < 0xF0)
+    {
+      if (end - p < 3)
+	return 0;
+      if ((c == 0xE0 && p[1] < 0xA0)
+	  || (c == 0xED && p[1] > 0x9F)
+	  || !is_continuation (p[1])
+	  || !is_continuation (p[2]))
+	return 0;
+      return 3;
+    }
+
+  if (c < 0xF5)
+    {
+      if (end - p < 4)
+	return 0;
+      if ((c == 0xF0 && p[1] < 0x90)
+	  || (c == 0xF4 && p[1] > 0x8F)
+	  || !is_continuation (p[1])
+	  || !is_continuation (p[2])
+	  || !is_continuation (p[3]))
+	return 0;
+      return 4;
+    }
+
+  return 0;
+}
+
+/* Validate INPUT as UTF-8, as g_utf8_validate() does, and return its
+ * length in bytes and in characters, in a single pass.  Runs of ASCII
+ * are skipped with SSE2 or AVX2 when the CPU supports them.  If LEN
+ * is negative, INPUT is nul-terminated; its length is then taken
+ * first, since the vectorized loops would otherwise have to read
+ * past the nul.  */
+gboolean
+_translit_utf8_validate_count (const gchar *input,
+			       gssize       len,
+			       gsize       *byte_len,
+			       gsize       *n_chars)
+{
+  static SkipAsciiFunc skip_ascii = NULL;
+  const guchar *p = (const guchar *) input, *end, *q;
+  gsize count = 0;
+
+  if (G_UNLIKELY (skip_ascii == NULL))
+    skip_ascii = choose_skip_ascii ();
+
+  /* INPUT may be NULL if LEN is 0.  */
+  if (len == 0)
+    {
+      if (byte_len)
+	*byte_len = 0;
+      if (n_chars)
+	*n_chars = 0;
+      return TRUE;
+    }
+
+  end = p + (len < 0 ? strlen (input) : (gsize) len);
+  for (;;)
+    {
+      gsize length;
+
+      q = skip_ascii (p, end);
+      count += q - p;
+      p = q;
+
+      if (p == end)
+	break;
+
+      length = decode_length (p, end);
+      if (length == 0)
+	return FALSE;
+      p += length;
+      count++;
+    }
+
+  if (byte_len)
+    *byte_len = p - (const guchar *) input;
+  if (n_chars)
+    *n_chars = count;
+  return TRUE;
+}
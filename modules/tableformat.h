@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TABLE_FORMAT_H__
+#define __TABLE_FORMAT_H__
+
+#include <glib.h>
+
+/* A compiled table is a double-array trie over the UTF-8 bytes of
+ * the keys, laid out so that it can be used directly from a
+ * read-only memory mapping:
+ *
+ *   TableHeader header;
+ *   gint32      base[n_states];
+ *   gint32      check[n_states];
+ *   guint32     value[n_states];
+ *   guchar      pool[pool_size];
+ *
+ * State 0 is the root.  The transition from state S with byte C
+ * leads to state T = BASE[S] + C, if CHECK[T] == S.  VALUE[T] is
+ * TABLE_NO_VALUE, or the offset in POOL of the output for the key
+ * which ends at T, stored as a guint32 length followed by the UTF-8
+ * bytes.  All numbers are in the byte order of the host which
+ * compiled the table.  */
+
+#define TABLE_MAGIC "TRTABLE"
+#define TABLE_VERSION 1
+#define TABLE_BYTE_ORDER 0x01020304
+#define TABLE_NO_VALUE G_MAXUINT32
+
+typedef struct _TableHeader TableHeader;
+
+struct _TableHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 n_states;
+  guint32 pool_size;
+};
+
+#endif	/* __TABLE_FORMAT_H__ */
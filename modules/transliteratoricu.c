@@ -20,6 +20,8 @@
 #include <libtranslit/translit.h>
 #include <unicode/ustring.h>
 #include <unicode/utrans.h>
+#include <unicode/utf16.h>
+#include <unicode/uset.h>
 #include <string.h>
 #include <gio/gio.h>
 
@@ -28,10 +30,59 @@
 #define TRANSLITERATOR_ICU_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TYPE_TRANSLITERATOR_ICU, TransliteratorIcuClass))
 #define TRANSLITERATOR_ICU_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), TYPE_TRANSLITERATOR_ICU, TransliteratorIcuClass))
 
+/* Inputs shorter than this (in bytes) are converted in a buffer on
+ * the stack.  */
+#define STACK_BUFFER_SIZE 256
+
+/* The upper limit of the learned growth of the text, in percent.  */
+#define MAX_EXPANSION 300
+
+typedef struct _IcuBuffer IcuBuffer;
+
+struct _IcuBuffer
+{
+  UChar *data;
+  int32_t capacity;
+  gboolean is_static;
+
+  /* where the data is allocated when it grows, instead of the heap */
+  TranslitArena *arena;
+};
+
+/* A UReplaceable which ICU edits in place, growing the buffer as
+ * needed, so that a string never has to be transliterated again
+ * because the result did not fit.  */
+typedef struct _IcuReplaceable IcuReplaceable;
+
+struct _IcuReplaceable
+{
+  IcuBuffer *buffer;
+  int32_t length;
+};
+
 struct _TransliteratorIcu
 {
   TranslitTransliterator parent;
   UTransliterator *trans;
+
+  /* Scratch buffer reused across calls, protected by MUTEX.  */
+  GMutex mutex;
+  IcuBuffer buffer;
+
+  /* The largest growth of the text seen so far, in percent of the
+   * input length, used to size the buffer in advance.  */
+  volatile gint expansion;
+
+  /* The characters which may be modified, as a table for ASCII, a
+   * bitmap for the BMP and a USet for the rest, used by would_change.
+   * SOURCE_BMP is NULL if the source set is not known to be complete.  */
+  guint8 source_ascii[128];
+  gboolean source_ascii_empty;
+  guint8 *source_bmp;
+  USet *source_set;
+
+  /* whether the ID is in context_free_ids */
+  gboolean context_free_tokens;
 };
 
 struct _TransliteratorIcuClass
@@ -42,6 +93,36 @@ struct _TransliteratorIcuClass
 typedef struct _TransliteratorIcu TransliteratorIcu;
 typedef struct _TransliteratorIcuClass TransliteratorIcuClass;
 
+#define TYPE_SESSION_ICU (session_icu_get_type())
+#define SESSION_ICU(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_SESSION_ICU, SessionIcu))
+
+/* The number of UTF-16 code units kept before the committed position
+ * of a session, as the context for the following input.  */
+#define SESSION_CONTEXT_LENGTH 16
+
+struct _SessionIcu
+{
+  TranslitSession parent;
+
+  /* TEXT[0, COMMITTED) has already been returned as committed
+   * output, and POS tracks the incremental transliteration of
+   * TEXT[0, LENGTH).  */
+  IcuBuffer text;
+  int32_t length;
+  int32_t committed;
+  UTransPosition pos;
+
+  GString *pending;
+};
+
+struct _SessionIcuClass
+{
+  TranslitSessionClass parent_class;
+};
+
+typedef struct _SessionIcu SessionIcu;
+typedef struct _SessionIcuClass SessionIcuClass;
+
 static void initable_iface_init (GInitableIface *initable_iface);
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED (TransliteratorIcu,
@@ -51,112 +132,674 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED (TransliteratorIcu,
 				G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
 						       initable_iface_init));
 
-static gchar *
-transliterator_icu_real_transliterate (TranslitTransliterator *self,
-                                       const gchar            *input,
-                                       guint                  *endpos,
-                                       GError                **error)
+G_DEFINE_DYNAMIC_TYPE (SessionIcu, session_icu, TRANSLIT_TYPE_SESSION);
+
+static void
+icu_buffer_init_static (IcuBuffer *buffer, UChar *data, int32_t capacity)
 {
-  TransliteratorIcu *icu = TRANSLITERATOR_ICU (self);
-  gchar *output;
-  int32_t outputLength;
-  gint n_filtered = 0;
-  UChar *ustr;
-  int32_t ustrLength, ustrCapacity, limit;
-  UChar *inputUstr;
-  int32_t inputUstrLength;
-  UErrorCode errorCode;
+  buffer->data = data;
+  buffer->capacity = capacity;
+  buffer->is_static = TRUE;
+  buffer->arena = NULL;
+}
 
-  errorCode = 0;
-  u_strFromUTF8 (NULL, 0, &inputUstrLength, input, strlen (input), &errorCode);
-  if (errorCode != U_BUFFER_OVERFLOW_ERROR)
+/* Make BUFFER grow into ARENA, so that it needs not be freed.  */
+static void
+icu_buffer_init_arena (IcuBuffer *buffer, TranslitArena *arena)
+{
+  buffer->data = NULL;
+  buffer->capacity = 0;
+  buffer->is_static = TRUE;
+  buffer->arena = arena;
+}
+
+static void
+icu_buffer_clear (IcuBuffer *buffer)
+{
+  if (!buffer->is_static)
+    g_free (buffer->data);
+  buffer->data = NULL;
+  buffer->capacity = 0;
+  buffer->is_static = FALSE;
+  buffer->arena = NULL;
+}
+
+/* Make sure that BUFFER can hold LENGTH code units, keeping the
+ * contents.  */
+static void
+icu_buffer_reserve (IcuBuffer *buffer, int32_t length)
+{
+  int32_t capacity;
+
+  if (buffer->capacity >= length)
+    return;
+
+  capacity = buffer->capacity < G_MAXINT32 / 2 ? buffer->capacity * 2 : 0;
+  capacity = MAX (length, capacity);
+  if (buffer->is_static)
     {
-      g_warning ("can't get the number of chars in UTF-8 string: %s",
-		 u_errorName (errorCode));
-      return NULL;
+      UChar *data;
+
+      if (buffer->arena)
+	data = translit_arena_alloc (buffer->arena, capacity * sizeof (UChar));
+      else
+	{
+	  data = g_new (UChar, capacity);
+	  buffer->is_static = FALSE;
+	}
+      if (buffer->capacity > 0)
+	memcpy (data, buffer->data, buffer->capacity * sizeof (UChar));
+      buffer->data = data;
     }
+  else
+    buffer->data = g_renew (UChar, buffer->data, capacity);
+  buffer->capacity = capacity;
+}
+
+static int32_t
+icu_replaceable_length (const UReplaceable *rep)
+{
+  return ((const IcuReplaceable *) rep)->length;
+}
+
+static UChar
+icu_replaceable_char_at (const UReplaceable *rep, int32_t offset)
+{
+  const IcuReplaceable *replaceable = (const IcuReplaceable *) rep;
+
+  if (offset < 0 || offset >= replaceable->length)
+    return 0xFFFF;
+  return replaceable->buffer->data[offset];
+}
+
+static UChar32
+icu_replaceable_char32_at (const UReplaceable *rep, int32_t offset)
+{
+  const IcuReplaceable *replaceable = (const IcuReplaceable *) rep;
+  UChar32 c;
+
+  if (offset < 0 || offset >= replaceable->length)
+    return 0xFFFF;
+  U16_GET (replaceable->buffer->data, 0, offset, replaceable->length, c);
+  return c;
+}
+
+static void
+icu_replaceable_replace (UReplaceable *rep,
+			 int32_t       start,
+			 int32_t       limit,
+			 const UChar  *text,
+			 int32_t       textLength)
+{
+  IcuReplaceable *replaceable = (IcuReplaceable *) rep;
+  IcuBuffer *buffer = replaceable->buffer;
+  UChar *copy = NULL;
+
+  /* TEXT may point into the buffer, which can be moved below.  */
+  if (text >= buffer->data && text < buffer->data + buffer->capacity)
+    text = copy = g_memdup (text, textLength * sizeof (UChar));
+
+  icu_buffer_reserve (buffer,
+		      replaceable->length - (limit - start) + textLength);
+  memmove (buffer->data + start + textLength,
+	   buffer->data + limit,
+	   (replaceable->length - limit) * sizeof (UChar));
+  memcpy (buffer->data + start, text, textLength * sizeof (UChar));
+  replaceable->length += textLength - (limit - start);
+
+  g_free (copy);
+}
+
+static void
+icu_replaceable_extract (UReplaceable *rep,
+			 int32_t       start,
+			 int32_t       limit,
+			 UChar        *dst)
+{
+  IcuReplaceable *replaceable = (IcuReplaceable *) rep;
+
+  memcpy (dst, replaceable->buffer->data + start,
+	  (limit - start) * sizeof (UChar));
+}
+
+static void
+icu_replaceable_copy (UReplaceable *rep,
+		      int32_t       start,
+		      int32_t       limit,
+		      int32_t       dest)
+{
+  IcuReplaceable *replaceable = (IcuReplaceable *) rep;
+
+  icu_replaceable_replace (rep, dest, dest,
+			   replaceable->buffer->data + start,
+			   limit - start);
+}
 
-  inputUstr = g_malloc0_n (inputUstrLength + 1, sizeof (UChar));
+static const UReplaceableCallbacks icu_replaceable_callbacks =
+  {
+    icu_replaceable_length,
+    icu_replaceable_char_at,
+    icu_replaceable_char32_at,
+    icu_replaceable_replace,
+    icu_replaceable_extract,
+    icu_replaceable_copy
+  };
+
+/* Get the scratch buffer of ICU, or FALLBACK if it is in use by
+ * another thread.  */
+static IcuBuffer *
+transliterator_icu_acquire_buffer (TransliteratorIcu *icu,
+				   IcuBuffer         *fallback)
+{
+  if (g_mutex_trylock (&icu->mutex))
+    return &icu->buffer;
+  return fallback;
+}
+
+static void
+transliterator_icu_release_buffer (TransliteratorIcu *icu,
+				   IcuBuffer         *buffer)
+{
+  if (buffer == &icu->buffer)
+    g_mutex_unlock (&icu->mutex);
+  else
+    icu_buffer_clear (buffer);
+}
+
+static gboolean
+convert_from_utf8 (IcuBuffer   *buffer,
+		   const gchar *input,
+		   gsize        len,
+		   int32_t     *length,
+		   GError     **error)
+{
+  UErrorCode errorCode;
 
   errorCode = 0;
-  u_strFromUTF8 (inputUstr, inputUstrLength + 1, NULL, input, strlen (input),
+  u_strFromUTF8 (buffer->data, buffer->capacity, length, input, len,
 		 &errorCode);
-  if (errorCode != U_ZERO_ERROR)
+  if (U_FAILURE (errorCode))
     {
-      g_free (inputUstr);
-      g_warning ("can't convert UTF-8 string to ustring: %s",
-		 u_errorName (errorCode));
-      return NULL;
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_FAILED,
+		   "can't convert UTF-8 string to ustring: %s",
+		   u_errorName (errorCode));
+      return FALSE;
     }
+  return TRUE;
+}
 
-  ustrCapacity = inputUstrLength + 1;
-  ustr = g_memdup (inputUstr, ustrCapacity * sizeof (UChar));
+static gboolean
+transliterate_one (TransliteratorIcu *icu,
+		   const gchar       *input,
+		   gsize              len,
+		   GString           *output,
+		   IcuBuffer         *buffer,
+		   guint             *endpos,
+		   GError           **error)
+{
+  gsize outputOffset;
+  int32_t outputLength, outputCapacity;
+  int32_t ustrLength, limit;
+  int32_t inputUstrLength, capacity;
+  IcuReplaceable replaceable;
+  gint expansion;
+  UErrorCode errorCode;
 
-  do
+  if (len >= G_MAXINT32 / 4)
     {
-      ustrLength = inputUstrLength;
-      limit = inputUstrLength;
-      errorCode = 0;
-
-      /* We can't use utrans_transIncrementalUChars here, since the
-       * output is sometimes unacceptable.
-       *
-       * For example, with the "Latin-Katakana" transliterator,
-       * "kakikukeko" does not turn into Japanese characters until one
-       * more vovel character follows.
-       */
-      utrans_transUChars (icu->trans,
-			  ustr, &ustrLength, ustrCapacity,
-			  0, &limit,
-			  &errorCode);
-      if (errorCode == U_BUFFER_OVERFLOW_ERROR)
-	{
-	  ustrCapacity = ustrLength + 1;
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_INVALID_INPUT,
+		   "input too long");
+      return FALSE;
+    }
 
-	  ustr = g_realloc_n (ustr, ustrCapacity, sizeof (UChar));
-	  memset (ustr, 0, ustrCapacity * sizeof (UChar));
-	  memcpy (ustr, inputUstr, inputUstrLength * sizeof (UChar));
-	}
+  /* A UTF-8 string never takes fewer bytes than UTF-16 code units,
+   * so the conversion always fits in one pass.  Leave room for the
+   * growth seen so far, so that the buffer is rarely reallocated
+   * during transliteration.  */
+  expansion = g_atomic_int_get (&icu->expansion);
+  icu_buffer_reserve (buffer, len + (gint64) len * expansion / 100 + 1);
+  translit_trace_begin ("icu:from_utf8");
+  if (!convert_from_utf8 (buffer, input, len, &inputUstrLength, error))
+    {
+      translit_trace_end ();
+      return FALSE;
     }
-  while (errorCode == U_BUFFER_OVERFLOW_ERROR);
+  translit_trace_end ();
 
-  g_free (inputUstr);
+  replaceable.buffer = buffer;
+  replaceable.length = inputUstrLength;
+  limit = inputUstrLength;
+  capacity = buffer->capacity;
+  errorCode = 0;
 
-  if (errorCode != U_ZERO_ERROR && errorCode != U_STRING_NOT_TERMINATED_WARNING)
+  /* We can't use utrans_transIncremental here, since the output is
+   * sometimes unacceptable.
+   *
+   * For example, with the "Latin-Katakana" transliterator,
+   * "kakikukeko" does not turn into Japanese characters until one
+   * more vovel character follows.
+   */
+  translit_trace_begin ("icu:utrans_trans");
+  utrans_trans (icu->trans,
+		(UReplaceable *) &replaceable, &icu_replaceable_callbacks,
+		0, &limit,
+		&errorCode);
+  translit_trace_end ();
+  if (U_FAILURE (errorCode))
     {
-      g_free (ustr);
       g_set_error (error,
 		   TRANSLIT_ERROR,
 		   TRANSLIT_ERROR_FAILED,
 		   "failed to transliterate: %s", u_errorName (errorCode));
-      return NULL;
+      return FALSE;
+    }
+  ustrLength = replaceable.length;
+  if (buffer->capacity != capacity)
+    translit_transliterator_add_retries (TRANSLIT_TRANSLITERATOR (icu), 1);
+  if (ustrLength > G_MAXINT32 / 3)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_FAILED,
+		   "output too long");
+      return FALSE;
     }
 
-  errorCode = 0;
-  u_strToUTF8 (NULL, 0, &outputLength, ustr, ustrLength, &errorCode);
-  if (errorCode != U_BUFFER_OVERFLOW_ERROR)
+  if (ustrLength > inputUstrLength && inputUstrLength > 0)
     {
-      g_warning ("can't get the number of byte required to convert ustring: %s",
-		 u_errorName (errorCode));
-      return NULL;
+      gint growth = MIN ((gint64) (ustrLength - inputUstrLength) * 100
+			 / inputUstrLength + 1,
+			 MAX_EXPANSION);
+
+      if (growth > expansion)
+	g_atomic_int_set (&icu->expansion, growth);
     }
 
-  output = g_malloc0 (outputLength + 1);
+  /* A UTF-16 code unit never takes more than 3 bytes in UTF-8, so
+   * reserve that much in OUTPUT and convert directly into it.  */
+  outputOffset = output->len;
+  outputCapacity = ustrLength * 3;
+  g_string_set_size (output, outputOffset + outputCapacity);
+
   errorCode = 0;
-  u_strToUTF8 (output, outputLength + 1, NULL, ustr, ustrLength, &errorCode);
-  g_free (ustr);
-  if (errorCode != U_ZERO_ERROR)
+  translit_trace_begin ("icu:to_utf8");
+  u_strToUTF8 (output->str + outputOffset, outputCapacity, &outputLength,
+	       buffer->data, ustrLength, &errorCode);
+  translit_trace_end ();
+  if (U_FAILURE (errorCode))
     {
-      g_free (output);
-      g_warning ("can't convert ustring to UTF-8 string: %s",
-		 u_errorName (errorCode));
-      return NULL;
+      g_string_truncate (output, outputOffset);
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_FAILED,
+		   "can't convert ustring to UTF-8 string: %s",
+		   u_errorName (errorCode));
+      return FALSE;
     }
+  g_string_truncate (output, outputOffset + outputLength);
 
   if (endpos)
     *endpos = inputUstrLength;
 
-  return output;
+  return TRUE;
+}
+
+static inline gboolean
+transliterator_icu_in_source_set (TransliteratorIcu *icu, gunichar uc)
+{
+  if (uc < 0x10000)
+    return (icu->source_bmp[uc >> 3] & (1 << (uc & 7))) != 0;
+  return uset_contains (icu->source_set, uc);
+}
+
+/* Return the first character in [P, END) which is in the source set
+ * of ICU, or END.  */
+static const gchar *
+skip_unaffected (TransliteratorIcu *icu, const gchar *p, const gchar *end)
+{
+  while (p < end)
+    {
+      guchar c = *p;
+
+      if (c < 0x80)
+	{
+	  /* Skip 8 bytes at a time if none of them is in the source
+	   * set, that is, they are all ASCII.  */
+	  if (icu->source_ascii_empty)
+	    {
+	      guint64 word;
+
+	      while (end - p >= 8)
+		{
+		  memcpy (&word, p, sizeof (word));
+		  if ((word & G_GUINT64_CONSTANT (0x8080808080808080)) != 0)
+		    break;
+		  p += 8;
+		}
+	      while (p < end && (guchar) *p < 0x80)
+		p++;
+	      continue;
+	    }
+
+	  if (icu->source_ascii[c])
+	    return p;
+	  p++;
+	  continue;
+	}
+
+      if (transliterator_icu_in_source_set (icu, g_utf8_get_char (p)))
+	return p;
+      p = g_utf8_next_char (p);
+    }
+  return end;
+}
+
+/* Transliterate INPUT as a whole, recording it as a single run in
+ * RESULT if not NULL: ICU does not tell which part of the output comes
+ * from which part of the input.  */
+static gboolean
+transliterate_recorded (TransliteratorIcu *icu,
+			const gchar       *input,
+			gsize              len,
+			GString           *output,
+			IcuBuffer         *buffer,
+			guint             *endpos,
+			TranslitResult    *result,
+			GError           **error)
+{
+  gsize offset = output->len;
+
+  if (!transliterate_one (icu, input, len, output, buffer, endpos, error))
+    return FALSE;
+  if (result)
+    translit_result_add_run (result, len, output->len - offset);
+  return TRUE;
+}
+
+static gboolean
+transliterate_buffered (TransliteratorIcu *icu,
+			const gchar       *input,
+			gsize              len,
+			GString           *output,
+			guint             *endpos,
+			TranslitResult    *result,
+			GError           **error)
+{
+  UChar stackBuffer[STACK_BUFFER_SIZE];
+  IcuBuffer local, *buffer;
+  gboolean retval;
+
+  /* Short strings don't need to contend for the scratch buffer.  */
+  icu_buffer_init_static (&local, stackBuffer, G_N_ELEMENTS (stackBuffer));
+  if (len < G_N_ELEMENTS (stackBuffer))
+    buffer = &local;
+  else
+    buffer = transliterator_icu_acquire_buffer (icu, &local);
+
+  retval = transliterate_recorded (icu, input, len, output, buffer, endpos,
+				   result, error);
+  transliterator_icu_release_buffer (icu, buffer);
+
+  return retval;
+}
+
+static gboolean
+transliterator_icu_real_transliterate_full (TranslitTransliterator *self,
+                                            const gchar            *input,
+                                            gsize                   len,
+                                            gssize                  n_chars,
+                                            GString                *output,
+                                            guint                  *endpos,
+                                            TranslitResult         *result,
+                                            GError                **error)
+{
+  TransliteratorIcu *icu = TRANSLITERATOR_ICU (self);
+  guint n;
+
+  if (result == NULL)
+    return transliterate_buffered (icu, input, len, output, endpos, NULL,
+				   error);
+
+  if (!transliterate_buffered (icu, input, len, output, &n, result, error))
+    return FALSE;
+
+  if (endpos)
+    *endpos = n;
+
+  /* utrans_trans() always consumes the whole input.  */
+  translit_result_set_end (result, n, len);
+
+  return TRUE;
+}
+
+/* Transliterate each of INPUTS, allocating OUTPUTS from ARENA if it
+ * is not NULL.  */
+static gboolean
+transliterate_batch (TransliteratorIcu   *icu,
+		     const gchar * const *inputs,
+		     gsize                n_inputs,
+		     gchar              **outputs,
+		     guint               *endpos,
+		     TranslitArena       *arena,
+		     GError             **error)
+{
+  UChar stackBuffer[STACK_BUFFER_SIZE];
+  IcuBuffer local, *buffer;
+  GString *output;
+  gsize i;
+
+  /* The UTF-16 buffer and the output buffer are shared among all the
+   * items, so that they are only reallocated when an item is longer
+   * than any of the previous ones.  If the buffer of ICU is in use,
+   * the one which replaces it grows into ARENA.  */
+  if (arena)
+    {
+      icu_buffer_init_arena (&local, arena);
+      output = translit_arena_get_scratch (arena);
+    }
+  else
+    {
+      icu_buffer_init_static (&local, stackBuffer,
+			      G_N_ELEMENTS (stackBuffer));
+      output = g_string_new (NULL);
+    }
+  buffer = transliterator_icu_acquire_buffer (icu, &local);
+  if (buffer == &local && arena)
+    icu_buffer_reserve (&local, STACK_BUFFER_SIZE);
+  for (i = 0; i < n_inputs; i++)
+    {
+      g_string_truncate (output, 0);
+      if (!transliterate_recorded (icu,
+				   inputs[i], strlen (inputs[i]),
+				   output,
+				   buffer,
+				   &endpos[i],
+				   NULL,
+				   error))
+	break;
+      outputs[i] = translit_arena_strndup (arena, output->str, output->len);
+    }
+  if (arena == NULL)
+    g_string_free (output, TRUE);
+  transliterator_icu_release_buffer (icu, buffer);
+
+  return i == n_inputs;
+}
+
+static gboolean
+transliterator_icu_real_transliterate_batch_arena (TranslitTransliterator *self,
+						   const gchar * const    *inputs,
+						   gsize                   n_inputs,
+						   gchar                 **outputs,
+						   guint                  *endpos,
+						   TranslitArena          *arena,
+						   GError                **error)
+{
+  return transliterate_batch (TRANSLITERATOR_ICU (self),
+			      inputs, n_inputs, outputs, endpos,
+			      arena, error);
+}
+
+static gboolean
+transliterator_icu_real_would_change (TranslitTransliterator *self,
+				      const gchar            *input,
+				      gsize                   len)
+{
+  TransliteratorIcu *icu = TRANSLITERATOR_ICU (self);
+
+  if (icu->source_bmp == NULL)
+    return TRUE;
+
+  return skip_unaffected (icu, input, input + len) < input + len;
+}
+
+/* Return TRUE if the rules of ICU are a single set of rules, whose
+ * source set is computed from the keys of the rules.  ICU only guesses
+ * the source set of the other transliterators: that of a compound one
+ * reflects its first stage (e.g. Latin-Katakana only lists fullwidth
+ * Latin), and that of a normalizer is empty.  */
+static gboolean
+transliterator_icu_source_set_is_complete (TransliteratorIcu *icu)
+{
+  static const UChar compound[] = { ':', ':', 0 };
+  UChar *rules;
+  int32_t length;
+  UErrorCode errorCode;
+  gboolean retval;
+
+  errorCode = 0;
+  length = utrans_toRules (icu->trans, FALSE, NULL, 0, &errorCode);
+  if (errorCode != U_BUFFER_OVERFLOW_ERROR || length == 0)
+    return FALSE;
+
+  rules = g_new (UChar, length + 1);
+  errorCode = 0;
+  utrans_toRules (icu->trans, FALSE, rules, length + 1, &errorCode);
+  retval = U_SUCCESS (errorCode) && u_strstr (rules, compound) == NULL;
+  g_free (rules);
+
+  return retval;
+}
+
+/* Compute the tables of the characters which ICU may modify.  If the
+ * source set is not known to be complete, they are left empty and
+ * every character is assumed to be affected.  */
+static void
+transliterator_icu_init_source_set (TransliteratorIcu *icu)
+{
+  USet *set;
+  UChar32 start, end, uc;
+  int32_t i, n_items;
+  UErrorCode errorCode;
+
+  if (!transliterator_icu_source_set_is_complete (icu))
+    return;
+
+  set = uset_openEmpty ();
+  errorCode = 0;
+  utrans_getSourceSet (icu->trans, FALSE, set, &errorCode);
+
+  if (U_FAILURE (errorCode) || uset_isEmpty (set))
+    {
+      uset_close (set);
+      return;
+    }
+
+  icu->source_bmp = g_new0 (guint8, 0x10000 / 8);
+  n_items = uset_getItemCount (set);
+  for (i = 0; i < n_items; i++)
+    {
+      errorCode = 0;
+      /* Strings are ignored; they start with a character which is in
+       * the set anyway.  */
+      if (uset_getItem (set, i, &start, &end, NULL, 0, &errorCode) != 0)
+	continue;
+      for (uc = start; uc <= end && uc < 0x10000; uc++)
+	icu->source_bmp[uc >> 3] |= 1 << (uc & 7);
+    }
+
+  icu->source_ascii_empty = TRUE;
+  for (uc = 0; uc < 0x80; uc++)
+    {
+      icu->source_ascii[uc] = (icu->source_bmp[uc >> 3] & (1 << (uc & 7))) != 0;
+      if (icu->source_ascii[uc])
+	icu->source_ascii_empty = FALSE;
+    }
+
+  uset_freeze (set);
+  icu->source_set = set;
+}
+
+/* The IDs of the transliterators which map each character on its own.
+ * This can't be told from the source set, which may be incomplete and
+ * says nothing of the context of the rules (e.g. the apostrophe after
+ * "n" in Latin-Katakana), so only list those known to be safe.  */
+static const gchar * const context_free_ids[] =
+  {
+    "Hiragana-Katakana",
+    "Fullwidth-Halfwidth",
+    "Halfwidth-Fullwidth"
+  };
+
+static gboolean
+transliterator_icu_is_context_free (const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (context_free_ids); i++)
+    if (g_ascii_strcasecmp (name, context_free_ids[i]) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+static TranslitTransliteratorFlags
+transliterator_icu_real_get_flags (TranslitTransliterator *self)
+{
+  TransliteratorIcu *icu = TRANSLITERATOR_ICU (self);
+
+  return icu->context_free_tokens
+    ? TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS
+    : TRANSLIT_TRANSLITERATOR_FLAGS_NONE;
+}
+
+static TranslitSession *
+transliterator_icu_real_create_session (TranslitTransliterator *self)
+{
+  return g_object_new (TYPE_SESSION_ICU, "transliterator", self, NULL);
+}
+
+static TranslitTransliterator *
+transliterator_icu_real_clone (TranslitTransliterator *self,
+			       GError                **error)
+{
+  TransliteratorIcu *icu = TRANSLITERATOR_ICU (self), *clone;
+  UErrorCode errorCode;
+  gchar *name;
+
+  g_object_get (G_OBJECT (self), "name", &name, NULL);
+  clone = g_object_new (TYPE_TRANSLITERATOR_ICU, "name", name, NULL);
+  g_free (name);
+
+  errorCode = 0;
+  clone->trans = utrans_clone (icu->trans, &errorCode);
+  if (U_FAILURE (errorCode))
+    {
+      g_object_unref (clone);
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_LOAD_FAILED,
+		   "can't clone ICU utrans: %s",
+		   u_errorName (errorCode));
+      return NULL;
+    }
+  transliterator_icu_init_source_set (clone);
+  clone->context_free_tokens = icu->context_free_tokens;
+
+  return TRANSLIT_TRANSLITERATOR (clone);
 }
 
 static void
@@ -164,7 +807,13 @@ transliterator_icu_finalize (GObject *object)
 {
   TransliteratorIcu *icu = TRANSLITERATOR_ICU (object);
 
-  utrans_close (icu->trans);
+  if (icu->trans)
+    utrans_close (icu->trans);
+  icu_buffer_clear (&icu->buffer);
+  g_mutex_clear (&icu->mutex);
+  g_free (icu->source_bmp);
+  if (icu->source_set)
+    uset_close (icu->source_set);
 
   G_OBJECT_CLASS (transliterator_icu_parent_class)->finalize (object);
 }
@@ -176,7 +825,15 @@ transliterator_icu_class_init (TransliteratorIcuClass *klass)
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GParamSpec *pspec;
 
-  transliterator_class->transliterate = transliterator_icu_real_transliterate;
+  transliterator_class->transliterate_full =
+    transliterator_icu_real_transliterate_full;
+  transliterator_class->transliterate_batch_arena =
+    transliterator_icu_real_transliterate_batch_arena;
+  transliterator_class->create_session =
+    transliterator_icu_real_create_session;
+  transliterator_class->clone = transliterator_icu_real_clone;
+  transliterator_class->would_change = transliterator_icu_real_would_change;
+  transliterator_class->get_flags = transliterator_icu_real_get_flags;
 
   gobject_class->finalize = transliterator_icu_finalize;
 }
@@ -189,6 +846,7 @@ transliterator_icu_class_finalize (TransliteratorIcuClass *klass)
 static void
 transliterator_icu_init (TransliteratorIcu *self)
 {
+  g_mutex_init (&self->mutex);
 }
 
 static gboolean
@@ -223,6 +881,7 @@ initable_init (GInitable *initable,
 
   errorCode = 0;
   u_strFromUTF8 (idUstr, idUstrLength + 1, NULL, name, strlen (name), &errorCode);
+  icu->context_free_tokens = transliterator_icu_is_context_free (name);
   g_free (name);
   if (errorCode != U_ZERO_ERROR)
     {
@@ -251,6 +910,8 @@ initable_init (GInitable *initable,
 		   "can't open ICU utrans");
       return FALSE;
     }
+
+  transliterator_icu_init_source_set (icu);
   return TRUE;
 }
 
@@ -260,9 +921,247 @@ initable_iface_init (GInitableIface *initable_iface)
   initable_iface->init = initable_init;
 }
 
+static void
+append_ustr (GString *string, const UChar *ustr, int32_t ustrLength)
+{
+  gsize start = string->len, offset = start;
+
+  /* Convert in pieces whose UTF-8 form fits in an int32_t, without
+   * splitting a surrogate pair.  */
+  while (ustrLength > 0)
+    {
+      int32_t n = MIN (ustrLength, G_MAXINT32 / 3);
+      int32_t length;
+      UErrorCode errorCode;
+
+      if (n < ustrLength && U16_IS_LEAD (ustr[n - 1]))
+	n--;
+
+      g_string_set_size (string, offset + (gsize) n * 3);
+      errorCode = 0;
+      u_strToUTF8 (string->str + offset, n * 3, &length,
+		   ustr, n, &errorCode);
+      if (U_FAILURE (errorCode))
+	{
+	  g_string_truncate (string, start);
+	  return;
+	}
+      offset += length;
+      ustr += n;
+      ustrLength -= n;
+    }
+  g_string_truncate (string, offset);
+}
+
+/* Transliterate the pending text of ICU.  On error, the pending
+ * text is left in an unspecified state and should be discarded.  */
+static gboolean
+session_icu_transliterate (SessionIcu *icu,
+			   gboolean    incremental,
+			   GError    **error)
+{
+  TransliteratorIcu *transliterator;
+  IcuReplaceable replaceable;
+  int32_t limit;
+  UErrorCode errorCode;
+
+  transliterator = TRANSLITERATOR_ICU
+    (translit_session_get_transliterator (TRANSLIT_SESSION (icu)));
+
+  replaceable.buffer = &icu->text;
+  replaceable.length = icu->length;
+
+  errorCode = 0;
+  if (incremental)
+    utrans_transIncremental (transliterator->trans,
+			     (UReplaceable *) &replaceable,
+			     &icu_replaceable_callbacks,
+			     &icu->pos,
+			     &errorCode);
+  else
+    {
+      limit = icu->length;
+      utrans_trans (transliterator->trans,
+		    (UReplaceable *) &replaceable,
+		    &icu_replaceable_callbacks,
+		    icu->pos.start, &limit,
+		    &errorCode);
+      icu->pos.start = icu->pos.limit = icu->pos.contextLimit = limit;
+    }
+  icu->length = replaceable.length;
+
+  if (U_FAILURE (errorCode))
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_FAILED,
+		   "failed to transliterate: %s", u_errorName (errorCode));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+session_icu_commit (SessionIcu *icu, GString *committed)
+{
+  int32_t keep;
+
+  append_ustr (committed,
+	       icu->text.data + icu->committed,
+	       icu->pos.start - icu->committed);
+  icu->committed = icu->pos.start;
+
+  /* Drop the committed text, except for a few characters which may
+   * be used as the context.  */
+  keep = MAX (icu->pos.start - SESSION_CONTEXT_LENGTH, 0);
+  if (keep > 0)
+    {
+      memmove (icu->text.data, icu->text.data + keep,
+	       (icu->length - keep) * sizeof (UChar));
+      icu->length -= keep;
+      icu->committed -= keep;
+      icu->pos.contextStart = MAX (icu->pos.contextStart - keep, 0);
+      icu->pos.start -= keep;
+      icu->pos.limit -= keep;
+      icu->pos.contextLimit -= keep;
+    }
+}
+
+static void
+session_icu_real_reset (TranslitSession *session)
+{
+  SessionIcu *icu = SESSION_ICU (session);
+
+  icu->length = 0;
+  icu->committed = 0;
+  memset (&icu->pos, 0, sizeof (UTransPosition));
+  g_string_truncate (icu->pending, 0);
+}
+
+static gboolean
+session_icu_real_append (TranslitSession *session,
+			 const gchar     *input,
+			 gsize            len,
+			 GString         *committed,
+			 GError         **error)
+{
+  SessionIcu *icu = SESSION_ICU (session);
+  int32_t inputUstrLength;
+  UErrorCode errorCode;
+
+  if (len > G_MAXINT32 / 2 - icu->length)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_INVALID_INPUT,
+		   "input too long");
+      return FALSE;
+    }
+
+  /* The UTF-16 form is never longer than LEN.  */
+  icu_buffer_reserve (&icu->text, icu->length + len);
+
+  errorCode = 0;
+  u_strFromUTF8 (icu->text.data + icu->length,
+		 icu->text.capacity - icu->length,
+		 &inputUstrLength,
+		 input, len,
+		 &errorCode);
+  if (U_FAILURE (errorCode))
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_FAILED,
+		   "can't convert UTF-8 string to ustring: %s",
+		   u_errorName (errorCode));
+      return FALSE;
+    }
+  icu->length += inputUstrLength;
+  icu->pos.limit = icu->pos.contextLimit = icu->length;
+
+  if (!session_icu_transliterate (icu, TRUE, error))
+    {
+      session_icu_real_reset (session);
+      return FALSE;
+    }
+
+  session_icu_commit (icu, committed);
+
+  g_string_truncate (icu->pending, 0);
+  append_ustr (icu->pending,
+	       icu->text.data + icu->pos.start,
+	       icu->length - icu->pos.start);
+
+  return TRUE;
+}
+
+static gboolean
+session_icu_real_finish (TranslitSession *session,
+			 GString         *committed,
+			 GError         **error)
+{
+  SessionIcu *icu = SESSION_ICU (session);
+
+  if (icu->pos.start < icu->length)
+    {
+      if (!session_icu_transliterate (icu, FALSE, error))
+	return FALSE;
+    }
+
+  session_icu_commit (icu, committed);
+  session_icu_real_reset (session);
+
+  return TRUE;
+}
+
+static const gchar *
+session_icu_real_get_pending (TranslitSession *session)
+{
+  return SESSION_ICU (session)->pending->str;
+}
+
+static void
+session_icu_finalize (GObject *object)
+{
+  SessionIcu *icu = SESSION_ICU (object);
+
+  icu_buffer_clear (&icu->text);
+  g_string_free (icu->pending, TRUE);
+
+  G_OBJECT_CLASS (session_icu_parent_class)->finalize (object);
+}
+
+static void
+session_icu_class_init (SessionIcuClass *klass)
+{
+  TranslitSessionClass *session_class = TRANSLIT_SESSION_CLASS (klass);
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  session_class->append = session_icu_real_append;
+  session_class->finish = session_icu_real_finish;
+  session_class->reset = session_icu_real_reset;
+  session_class->get_pending = session_icu_real_get_pending;
+
+  gobject_class->finalize = session_icu_finalize;
+}
+
+static void
+session_icu_class_finalize (SessionIcuClass *klass)
+{
+}
+
+static void
+session_icu_init (SessionIcu *self)
+{
+  self->pending = g_string_new (NULL);
+  icu_buffer_reserve (&self->text, 64);
+}
+
 void
 transliterator_icu_register (GTypeModule *module)
 {
   transliterator_icu_register_type (module);
+  session_icu_register_type (module);
   translit_implement_transliterator ("icu", transliterator_icu_get_type ());
 }
@@ -27,21 +27,79 @@
 #define TRANSLITERATOR_M17N_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TYPE_TRANSLITERATOR_M17N, TransliteratorM17nClass))
 #define TRANSLITERATOR_M17N_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), TYPE_TRANSLITERATOR_M17N, TransliteratorM17nClass))
 
+/* The number of entries of SymbolCache.  */
+#define SYMBOL_CACHE_SIZE 256
+
+/* MSymbol of the characters beyond Latin-1 seen recently, directly
+ * mapped by their low bits, so that looking them up takes no lock.
+ * An entry whose character is 0 is empty.  It belongs to a single
+ * instance, which is not used by several threads at the same time.  */
+typedef struct _SymbolCache SymbolCache;
+
+struct _SymbolCache
+{
+  gunichar chars[SYMBOL_CACHE_SIZE];
+  MSymbol symbols[SYMBOL_CACHE_SIZE];
+};
+
 struct _TransliteratorM17n
 {
   TranslitTransliterator parent;
   MInputMethod *im;
   MInputContext *ic;
+
+  /* buffers for the committed text, reused across calls so that a
+   * commit allocates nothing; they don't make separate instances
+   * safe to use concurrently (see get_flags) */
+  MText *mt;
+  MConverter *converter;
+
+  /* ASCII keys which the input method passes through unchanged in
+   * its initial state, whose status text is INITIAL_STATUS  */
+  gboolean inert_keys[128];
+  MText *initial_status;
+
+  /* the transliterator which owns IM, if this is a clone */
+  struct _TransliteratorM17n *owner;
+
+  SymbolCache symbol_cache;
 };
 
 struct _TransliteratorM17nClass
 {
   TranslitTransliteratorClass parent_class;
+
+  /* MSymbol of each character, directly indexed for Latin-1 and
+   * looked up in SYMBOLS for the rest.  */
+  MSymbol latin1_symbols[256];
+  GHashTable *symbols;
 };
 
 typedef struct _TransliteratorM17n TransliteratorM17n;
 typedef struct _TransliteratorM17nClass TransliteratorM17nClass;
 
+#define TYPE_SESSION_M17N (session_m17n_get_type())
+#define SESSION_M17N(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_SESSION_M17N, SessionM17n))
+
+struct _SessionM17n
+{
+  TranslitSession parent;
+  MInputContext *ic;
+  MText *mt;
+  MConverter *converter;
+  GString *pending;
+
+  SymbolCache symbol_cache;
+};
+
+struct _SessionM17nClass
+{
+  TranslitSessionClass parent_class;
+};
+
+typedef struct _SessionM17n SessionM17n;
+typedef struct _SessionM17nClass SessionM17nClass;
+
 static void initable_iface_init (GInitableIface *initable_iface);
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED (TransliteratorM17n,
@@ -51,77 +109,159 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED (TransliteratorM17n,
 				G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
 						       initable_iface_init));
 
-static MConverter *utf8_converter;
+G_DEFINE_DYNAMIC_TYPE (SessionM17n, session_m17n, TRANSLIT_TYPE_SESSION);
+
+G_LOCK_DEFINE_STATIC (symbols);
 
-static char *
-mtext_to_utf8 (MText *mt)
+static MSymbol
+make_symbol (gunichar uc)
 {
-  char *buf;
-  size_t cap;
+  gchar utf8[7];
 
-  mconv_reset_converter (utf8_converter);
-  cap = (mtext_len (mt) + 1) * 6;
-  buf = (char *) malloc (cap);
-  mconv_rebind_buffer (utf8_converter, buf, cap);
-  mconv_encode (utf8_converter, mt);
+  utf8[g_unichar_to_utf8 (uc, utf8)] = '\0';
+  return msymbol (utf8);
+}
 
-  buf[utf8_converter->nbytes] = '\0';
+static MSymbol
+char_to_symbol (TransliteratorM17nClass *klass,
+		SymbolCache             *cache,
+		gunichar                 uc)
+{
+  MSymbol symbol;
+  guint index;
 
-  return buf;
+  if (uc < G_N_ELEMENTS (klass->latin1_symbols))
+    return klass->latin1_symbols[uc];
+
+  index = uc % SYMBOL_CACHE_SIZE;
+  if (cache->chars[index] == uc)
+    return cache->symbols[index];
+
+  G_LOCK (symbols);
+  symbol = g_hash_table_lookup (klass->symbols, GUINT_TO_POINTER (uc));
+  if (symbol == NULL)
+    {
+      symbol = make_symbol (uc);
+      g_hash_table_insert (klass->symbols, GUINT_TO_POINTER (uc), symbol);
+    }
+  G_UNLOCK (symbols);
+
+  cache->chars[index] = uc;
+  cache->symbols[index] = symbol;
+
+  return symbol;
 }
 
-static gchar *
-transliterator_m17n_real_transliterate (TranslitTransliterator *self,
-                                        const gchar            *input,
-                                        guint                  *endpos,
-                                        GError                **error)
+/* Encode MT into STRING with CONVERTER, directly into the space
+ * reserved at the end of STRING.  */
+static void
+append_mtext (GString *string, MText *mt, MConverter *converter)
 {
-  TransliteratorM17n *m17n = TRANSLITERATOR_M17N (self);
-  const gchar *p;
-  GString *string;
-  gchar *output;
+  gsize offset = string->len;
+  gsize capacity;
+
+  /* A character takes at most 6 bytes in m17n-lib's UTF-8.  */
+  capacity = mtext_len (mt) * 6;
+  g_string_set_size (string, offset + capacity);
+
+  mconv_reset_converter (converter);
+  mconv_rebind_buffer (converter,
+		       (unsigned char *) string->str + offset,
+		       capacity);
+  mconv_encode (converter, mt);
+
+  g_string_truncate (string, offset + converter->nbytes);
+}
+
+/* Check if UC can be appended to the output without going through
+ * minput_filter(), that is, IC has no preedit, is in the initial
+ * state, and UC is a key which does nothing in that state.  */
+static inline gboolean
+is_inert_key (TransliteratorM17n *m17n, MInputContext *ic, gunichar uc)
+{
+  return uc < G_N_ELEMENTS (m17n->inert_keys)
+    && m17n->inert_keys[uc]
+    && (ic->preedit == NULL || mtext_len (ic->preedit) == 0)
+    && ic->status == m17n->initial_status;
+}
+
+/* Transliterate INPUT, appending the output to STRING.  If RESULT is
+ * not NULL, record the span of each commit in it, and the ending
+ * position.  */
+static void
+transliterate_one (TransliteratorM17n *m17n,
+		   const gchar        *input,
+		   gsize               len,
+		   GString            *string,
+		   guint              *endpos,
+		   TranslitResult     *result)
+{
+  TransliteratorM17nClass *klass = TRANSLITERATOR_M17N_GET_CLASS (m17n);
+  const gchar *p, *end = input + len;
   gint n_filtered = 0;
+  guint n_chars = 0;
+  /* the input and the output up to the last commit */
+  const gchar *committed_input = input;
+  gsize committed_output = string->len;
 
-  string = g_string_sized_new (strlen (input));
+  /* Count the characters on the way, rather than with another pass
+   * over INPUT.  */
   minput_reset_ic (m17n->ic);
-  for (p = input; ; p = g_utf8_next_char (p))
+  for (p = input; ; p = g_utf8_next_char (p), n_chars++)
     {
-      gunichar uc = g_utf8_get_char (p);
+      gunichar uc;
       MSymbol symbol;
       gint retval;
 
-      if (*p == '\0')
-	symbol = Mnil;
+      if (p == end)
+	{
+	  uc = 0;
+	  symbol = Mnil;
+	}
       else
 	{
-	  gint length;
-	  gchar *utf8;
-
-	  length = g_unichar_to_utf8 (uc, NULL);
-	  utf8 = g_slice_alloc0 (length + 1);
-	  g_unichar_to_utf8 (uc, utf8);
-	  symbol = msymbol (utf8);
-	  g_slice_free1 (length, utf8);
+	  uc = g_utf8_get_char (p);
+	  if (is_inert_key (m17n, m17n->ic, uc))
+	    {
+	      g_string_append_c (string, uc);
+	      n_filtered = 0;
+	      if (result)
+		{
+		  translit_result_add_run (result,
+					   p + 1 - committed_input,
+					   string->len - committed_output);
+		  committed_input = p + 1;
+		  committed_output = string->len;
+		}
+	      continue;
+	    }
+	  symbol = char_to_symbol (klass, &m17n->symbol_cache, uc);
 	}
 
       retval = minput_filter (m17n->ic, symbol, NULL);
       if (retval == 0)
 	{
-	  MText *mt = mtext ();
+	  retval = minput_lookup (m17n->ic, symbol, NULL, m17n->mt);
 
-	  retval = minput_lookup (m17n->ic, symbol, NULL, mt);
-
-	  if (mtext_len (mt) > 0) {
-	    output = mtext_to_utf8 (mt);
-	    g_string_append (string, output);
-	    g_free (output);
+	  if (mtext_len (m17n->mt) > 0) {
+	    append_mtext (string, m17n->mt, m17n->converter);
+	    mtext_del (m17n->mt, 0, mtext_len (m17n->mt));
 	  }
 
-	  if (retval)
+	  if (retval && symbol != Mnil)
 	    g_string_append_unichar (string, uc);
 
-	  m17n_object_unref (mt);
 	  n_filtered = 0;
+	  if (result)
+	    {
+	      const gchar *next = symbol == Mnil ? end : g_utf8_next_char (p);
+
+	      translit_result_add_run (result,
+				       next - committed_input,
+				       string->len - committed_output);
+	      committed_input = next;
+	      committed_output = string->len;
+	    }
 	}
       else
 	n_filtered++;
@@ -131,9 +271,130 @@ transliterator_m17n_real_transliterate (TranslitTransliterator *self,
     }
 
   if (endpos)
-    *endpos = g_utf8_strlen (input, -1) - n_filtered;
+    *endpos = n_chars - n_filtered;
+
+  if (result)
+    {
+      gint i;
+
+      /* The characters still in the preedit.  */
+      translit_result_add_run (result,
+			       end - committed_input,
+			       string->len - committed_output);
+
+      for (p = end, i = 0; i < n_filtered && p > input; i++)
+	p = g_utf8_prev_char (p);
+      translit_result_set_end (result, n_chars - n_filtered, p - input);
+    }
+}
+
+static gboolean
+transliterator_m17n_real_transliterate_full (TranslitTransliterator *self,
+                                             const gchar            *input,
+                                             gsize                   len,
+                                             gssize                  n_chars,
+                                             GString                *output,
+                                             guint                  *endpos,
+                                             TranslitResult         *result,
+                                             GError                **error)
+{
+  TransliteratorM17n *m17n = TRANSLITERATOR_M17N (self);
+
+  transliterate_one (m17n, input, len, output, endpos, result);
+
+  return TRUE;
+}
+
+/* Transliterate each of INPUTS, allocating OUTPUTS from ARENA if it
+ * is not NULL.  */
+static void
+transliterate_batch (TransliteratorM17n  *m17n,
+		     const gchar * const *inputs,
+		     gsize                n_inputs,
+		     gchar              **outputs,
+		     guint               *endpos,
+		     TranslitArena       *arena)
+{
+  GString *string;
+  gsize i;
+
+  /* Share the output buffer among all the items.  */
+  string = arena ? translit_arena_get_scratch (arena) : g_string_new (NULL);
+  for (i = 0; i < n_inputs; i++)
+    {
+      g_string_truncate (string, 0);
+      transliterate_one (m17n,
+			 inputs[i], strlen (inputs[i]),
+			 string,
+			 &endpos[i],
+			 NULL);
+      outputs[i] = translit_arena_strndup (arena, string->str, string->len);
+    }
+  if (arena == NULL)
+    g_string_free (string, TRUE);
+}
 
-  return g_string_free (string, FALSE);
+static gboolean
+transliterator_m17n_real_transliterate_batch_arena (TranslitTransliterator *self,
+						    const gchar * const    *inputs,
+						    gsize                   n_inputs,
+						    gchar                 **outputs,
+						    guint                  *endpos,
+						    TranslitArena          *arena,
+						    GError                **error)
+{
+  transliterate_batch (TRANSLITERATOR_M17N (self),
+		       inputs, n_inputs, outputs, endpos, arena);
+
+  return TRUE;
+}
+
+static TranslitTransliteratorFlags
+transliterator_m17n_real_get_flags (TranslitTransliterator *self)
+{
+  /* Some input methods keep state outside of the input context,
+   * e.g. ja-anthy learns from the previous conversions.  Also,
+   * m17n-lib interns symbols and counts references in global state,
+   * and the instances of an input method share its MInputMethod.  */
+  return TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE
+    | TRANSLIT_TRANSLITERATOR_FLAG_THREAD_UNSAFE;
+}
+
+static TranslitSession *
+transliterator_m17n_real_create_session (TranslitTransliterator *self)
+{
+  return g_object_new (TYPE_SESSION_M17N, "transliterator", self, NULL);
+}
+
+static TranslitTransliterator *
+transliterator_m17n_real_clone (TranslitTransliterator *self,
+				GError                **error)
+{
+  TransliteratorM17n *m17n = TRANSLITERATOR_M17N (self), *clone;
+  gchar *name;
+
+  g_object_get (G_OBJECT (self), "name", &name, NULL);
+  clone = g_object_new (TYPE_TRANSLITERATOR_M17N, "name", name, NULL);
+  g_free (name);
+
+  /* Share the input method, which is immutable, and only create a
+   * new input context.  */
+  clone->owner = g_object_ref (m17n->owner ? m17n->owner : m17n);
+  clone->im = m17n->im;
+  clone->ic = minput_create_ic (clone->im, NULL);
+  memcpy (clone->inert_keys, m17n->inert_keys, sizeof (m17n->inert_keys));
+  clone->initial_status = m17n->initial_status;
+  if (clone->ic == NULL)
+    {
+      g_object_unref (clone);
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_LOAD_FAILED,
+		   "can't create m17n IC");
+      return NULL;
+    }
+
+  return TRANSLIT_TRANSLITERATOR (clone);
 }
 
 static void
@@ -143,8 +404,12 @@ transliterator_m17n_finalize (GObject *object)
 
   if (m17n->ic)
     minput_destroy_ic (m17n->ic);
-  if (m17n->im)
+  if (m17n->owner)
+    g_object_unref (m17n->owner);
+  else if (m17n->im)
     minput_close_im (m17n->im);
+  m17n_object_unref (m17n->mt);
+  mconv_free_converter (m17n->converter);
 
   G_OBJECT_CLASS (transliterator_m17n_parent_class)->finalize (object);
 }
@@ -155,25 +420,83 @@ transliterator_m17n_class_init (TransliteratorM17nClass *klass)
   TranslitTransliteratorClass *transliterator_class = TRANSLIT_TRANSLITERATOR_CLASS (klass);
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GParamSpec *pspec;
+  gunichar i;
 
-  transliterator_class->transliterate = transliterator_m17n_real_transliterate;
+  transliterator_class->transliterate_full =
+    transliterator_m17n_real_transliterate_full;
+  transliterator_class->transliterate_batch_arena =
+    transliterator_m17n_real_transliterate_batch_arena;
+  transliterator_class->create_session =
+    transliterator_m17n_real_create_session;
+  transliterator_class->clone = transliterator_m17n_real_clone;
+  transliterator_class->get_flags = transliterator_m17n_real_get_flags;
 
   gobject_class->finalize = transliterator_m17n_finalize;
 
   M17N_INIT ();
-  utf8_converter = mconv_buffer_converter (Mcoding_utf_8, NULL, 0);
+
+  /* Symbols are interned by m17n-lib and never freed, so they can be
+   * looked up once and for all.  */
+  for (i = 0; i < G_N_ELEMENTS (klass->latin1_symbols); i++)
+    klass->latin1_symbols[i] = make_symbol (i);
+  klass->symbols = g_hash_table_new (NULL, NULL);
 }
 
 static void
 transliterator_m17n_class_finalize (TransliteratorM17nClass *klass)
 {
-  mconv_free_converter (utf8_converter);
+  g_hash_table_destroy (klass->symbols);
   M17N_FINI ();
 }
 
 static void
 transliterator_m17n_init (TransliteratorM17n *self)
 {
+  self->mt = mtext ();
+  self->converter = mconv_buffer_converter (Mcoding_utf_8, NULL, 0);
+}
+
+/* Find the printable ASCII keys which the input method passes
+ * through unchanged in its initial state, by feeding each of them to
+ * a fresh input context.  */
+static void
+transliterator_m17n_probe_keys (TransliteratorM17n *m17n)
+{
+  TransliteratorM17nClass *klass = TRANSLITERATOR_M17N_GET_CLASS (m17n);
+  MInputContext *ic;
+  MText *mt;
+  gunichar uc;
+
+  ic = minput_create_ic (m17n->im, NULL);
+  if (ic == NULL)
+    return;
+
+  mt = mtext ();
+  minput_reset_ic (ic);
+  m17n->initial_status = ic->status;
+
+  for (uc = 0x20; uc < 0x7F; uc++)
+    {
+      MSymbol symbol = char_to_symbol (klass, &m17n->symbol_cache, uc);
+      gint retval;
+
+      minput_reset_ic (ic);
+      if (minput_filter (ic, symbol, NULL) != 0)
+	continue;
+
+      retval = minput_lookup (ic, symbol, NULL, mt);
+      m17n->inert_keys[uc] =
+	((retval != 0 && mtext_len (mt) == 0)
+	 || (retval == 0
+	     && mtext_len (mt) == 1
+	     && mtext_ref_char (mt, 0) == (gint) uc))
+	&& (ic->preedit == NULL || mtext_len (ic->preedit) == 0)
+	&& ic->status == m17n->initial_status;
+      mtext_del (mt, 0, mtext_len (mt));
+    }
+
+  m17n_object_unref (mt);
+  minput_destroy_ic (ic);
 }
 
 static gboolean
@@ -200,6 +523,7 @@ initable_init (GInitable *initable,
   if (m17n->im)
     {
       m17n->ic = minput_create_ic (m17n->im, NULL);
+      transliterator_m17n_probe_keys (m17n);
       return TRUE;
     }
   g_set_error (error,
@@ -215,9 +539,178 @@ initable_iface_init (GInitableIface *initable_iface)
   initable_iface->init = initable_init;
 }
 
+static void
+session_m17n_update_pending (SessionM17n *m17n)
+{
+  g_string_truncate (m17n->pending, 0);
+  if (m17n->ic->preedit && mtext_len (m17n->ic->preedit) > 0)
+    append_mtext (m17n->pending, m17n->ic->preedit, m17n->converter);
+}
+
+static void
+session_m17n_commit (SessionM17n *m17n,
+		     MSymbol      symbol,
+		     gunichar     uc,
+		     GString     *committed)
+{
+  gint retval;
+
+  retval = minput_lookup (m17n->ic, symbol, NULL, m17n->mt);
+
+  if (mtext_len (m17n->mt) > 0)
+    {
+      append_mtext (committed, m17n->mt, m17n->converter);
+      mtext_del (m17n->mt, 0, mtext_len (m17n->mt));
+    }
+
+  if (retval && symbol != Mnil)
+    g_string_append_unichar (committed, uc);
+}
+
+static gboolean
+session_m17n_real_append (TranslitSession *session,
+			  const gchar     *input,
+			  gsize            len,
+			  GString         *committed,
+			  GError         **error)
+{
+  SessionM17n *m17n = SESSION_M17N (session);
+  TransliteratorM17n *transliterator;
+  TransliteratorM17nClass *klass;
+  const gchar *p, *end = input + len;
+
+  transliterator = TRANSLITERATOR_M17N
+    (translit_session_get_transliterator (session));
+  klass = TRANSLITERATOR_M17N_GET_CLASS (transliterator);
+
+  /* Unlike transliterate_one, the input context is neither reset
+   * before nor flushed after the input, so that the next call can
+   * continue from the current state.  */
+  for (p = input; p < end; p = g_utf8_next_char (p))
+    {
+      gunichar uc = g_utf8_get_char (p);
+      MSymbol symbol;
+
+      if (is_inert_key (transliterator, m17n->ic, uc))
+	{
+	  g_string_append_c (committed, uc);
+	  continue;
+	}
+
+      symbol = char_to_symbol (klass, &m17n->symbol_cache, uc);
+      if (minput_filter (m17n->ic, symbol, NULL) == 0)
+	session_m17n_commit (m17n, symbol, uc, committed);
+    }
+
+  session_m17n_update_pending (m17n);
+  return TRUE;
+}
+
+static gboolean
+session_m17n_real_finish (TranslitSession *session,
+			  GString         *committed,
+			  GError         **error)
+{
+  SessionM17n *m17n = SESSION_M17N (session);
+
+  if (minput_filter (m17n->ic, Mnil, NULL) == 0)
+    session_m17n_commit (m17n, Mnil, 0, committed);
+
+  minput_reset_ic (m17n->ic);
+  g_string_truncate (m17n->pending, 0);
+  return TRUE;
+}
+
+static void
+session_m17n_real_reset (TranslitSession *session)
+{
+  SessionM17n *m17n = SESSION_M17N (session);
+
+  minput_reset_ic (m17n->ic);
+  g_string_truncate (m17n->pending, 0);
+}
+
+static const gchar *
+session_m17n_real_get_pending (TranslitSession *session)
+{
+  return SESSION_M17N (session)->pending->str;
+}
+
+static void
+session_m17n_constructed (GObject *object)
+{
+  SessionM17n *m17n = SESSION_M17N (object);
+  TransliteratorM17n *transliterator;
+
+  transliterator = TRANSLITERATOR_M17N
+    (translit_session_get_transliterator (TRANSLIT_SESSION (object)));
+  m17n->ic = minput_create_ic (transliterator->im, NULL);
+
+  if (G_OBJECT_CLASS (session_m17n_parent_class)->constructed)
+    G_OBJECT_CLASS (session_m17n_parent_class)->constructed (object);
+}
+
+static void
+session_m17n_dispose (GObject *object)
+{
+  SessionM17n *m17n = SESSION_M17N (object);
+
+  /* The input context must be destroyed before the input method,
+   * which is owned by the transliterator.  */
+  if (m17n->ic)
+    {
+      minput_destroy_ic (m17n->ic);
+      m17n->ic = NULL;
+    }
+
+  G_OBJECT_CLASS (session_m17n_parent_class)->dispose (object);
+}
+
+static void
+session_m17n_finalize (GObject *object)
+{
+  SessionM17n *m17n = SESSION_M17N (object);
+
+  m17n_object_unref (m17n->mt);
+  mconv_free_converter (m17n->converter);
+  g_string_free (m17n->pending, TRUE);
+
+  G_OBJECT_CLASS (session_m17n_parent_class)->finalize (object);
+}
+
+static void
+session_m17n_class_init (SessionM17nClass *klass)
+{
+  TranslitSessionClass *session_class = TRANSLIT_SESSION_CLASS (klass);
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  session_class->append = session_m17n_real_append;
+  session_class->finish = session_m17n_real_finish;
+  session_class->reset = session_m17n_real_reset;
+  session_class->get_pending = session_m17n_real_get_pending;
+
+  gobject_class->constructed = session_m17n_constructed;
+  gobject_class->dispose = session_m17n_dispose;
+  gobject_class->finalize = session_m17n_finalize;
+}
+
+static void
+session_m17n_class_finalize (SessionM17nClass *klass)
+{
+}
+
+static void
+session_m17n_init (SessionM17n *self)
+{
+  self->mt = mtext ();
+  self->converter = mconv_buffer_converter (Mcoding_utf_8, NULL, 0);
+  self->pending = g_string_new (NULL);
+}
+
 void
 transliterator_m17n_register (GTypeModule *module)
 {
   transliterator_m17n_register_type (module);
+  session_m17n_register_type (module);
   translit_implement_transliterator ("m17n", transliterator_m17n_get_type ());
 }
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include <gio/gio.h>
+#include <string.h>
+#include "tableformat.h"
+
+#define TYPE_TRANSLITERATOR_TABLE (transliterator_table_get_type())
+#define TRANSLITERATOR_TABLE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_TRANSLITERATOR_TABLE, TransliteratorTable))
+#define TRANSLITERATOR_TABLE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), TYPE_TRANSLITERATOR_TABLE, TransliteratorTableClass))
+#define TRANSLITERATOR_TABLE_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), TYPE_TRANSLITERATOR_TABLE, TransliteratorTableClass))
+
+struct _TransliteratorTable
+{
+  TranslitTransliterator parent;
+
+  /* The compiled table, mapped read-only so that its pages are
+   * shared among all the processes using it.  */
+  GMappedFile *file;
+  const gint32 *base;
+  const gint32 *check;
+  const guint32 *value;
+  const guchar *pool;
+  guint32 n_states;
+  guint32 pool_size;
+
+  /* whether a key starts with each byte */
+  gboolean first_bytes[256];
+};
+
+struct _TransliteratorTableClass
+{
+  TranslitTransliteratorClass parent_class;
+};
+
+typedef struct _TransliteratorTable TransliteratorTable;
+typedef struct _TransliteratorTableClass TransliteratorTableClass;
+
+static void initable_iface_init (GInitableIface *initable_iface);
+
+G_DEFINE_DYNAMIC_TYPE_EXTENDED (TransliteratorTable,
+				transliterator_table,
+				TRANSLIT_TYPE_TRANSLITERATOR,
+				0,
+				G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+						       initable_iface_init));
+
+static inline gint64
+next_state (TransliteratorTable *table, gint64 state, guchar c)
+{
+  gint64 next = (gint64) table->base[state] + c;
+
+  if (next <= 0 || next >= table->n_states || table->check[next] != state)
+    return -1;
+  return next;
+}
+
+/* Find the longest key which is a prefix of [P, END), and return its
+ * length, or 0 if there is none.  */
+static gsize
+longest_match (TransliteratorTable *table,
+	       const gchar         *p,
+	       const gchar         *end,
+	       guint32             *value)
+{
+  gint64 state = 0;
+  gsize length = 0;
+  const gchar *q;
+
+  for (q = p; q < end; q++)
+    {
+      state = next_state (table, state, *q);
+      if (state < 0)
+	break;
+      if (table->value[state] != TABLE_NO_VALUE)
+	{
+	  length = q + 1 - p;
+	  *value = table->value[state];
+	}
+    }
+
+  return length;
+}
+
+/* Transliterate INPUT, recording the spans of each key and of the
+ * text copied between them in RESULT, if it is not NULL.  */
+static gboolean
+transliterate_table (TransliteratorTable *table,
+		     const gchar         *input,
+		     gsize                len,
+		     GString             *output,
+		     TranslitResult      *result,
+		     GError             **error)
+{
+  const gchar *p, *q, *end = input + len;
+  gsize orig_len = output->len;
+
+  for (p = input; p < end; )
+    {
+      guint32 value, length;
+      gsize match_len = 0;
+
+      if (table->first_bytes[(guchar) *p])
+	match_len = longest_match (table, p, end, &value);
+
+      if (match_len == 0)
+	{
+	  if (table->first_bytes[(guchar) *p])
+	    q = g_utf8_next_char (p);
+	  else
+	    {
+	      /* Copy the bytes which no key starts with at once.  Keys
+	       * are valid UTF-8, so this stops at a character
+	       * boundary.  */
+	      for (q = p + 1; q < end && !table->first_bytes[(guchar) *q]; q++)
+		;
+	    }
+	  g_string_append_len (output, p, q - p);
+	  if (result)
+	    translit_result_add_run (result, q - p, q - p);
+	  p = q;
+	  continue;
+	}
+
+      if ((gsize) value + sizeof (length) > table->pool_size)
+	goto corrupted;
+      memcpy (&length, table->pool + value, sizeof (length));
+      if (length > table->pool_size - value - sizeof (length))
+	goto corrupted;
+
+      g_string_append_len (output,
+			   (const gchar *) table->pool + value + sizeof (length),
+			   length);
+      if (result)
+	translit_result_add_run (result, match_len, length);
+      p += match_len;
+    }
+
+  return TRUE;
+
+ corrupted:
+  g_string_truncate (output, orig_len);
+  g_set_error (error,
+	       TRANSLIT_ERROR,
+	       TRANSLIT_ERROR_FAILED,
+	       "corrupted table");
+  return FALSE;
+}
+
+static gboolean
+transliterator_table_real_transliterate_full (TranslitTransliterator *self,
+                                              const gchar            *input,
+                                              gsize                   len,
+                                              gssize                  n_chars,
+                                              GString                *output,
+                                              guint                  *endpos,
+                                              TranslitResult         *result,
+                                              GError                **error)
+{
+  TransliteratorTable *table = TRANSLITERATOR_TABLE (self);
+
+  if (!transliterate_table (table, input, len, output, result, error))
+    return FALSE;
+
+  /* The whole input is always consumed.  */
+  if (endpos || result)
+    {
+      if (n_chars < 0)
+	n_chars = g_utf8_strlen (input, len);
+      if (endpos)
+	*endpos = n_chars;
+      if (result)
+	translit_result_set_end (result, n_chars, len);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+transliterator_table_real_would_change (TranslitTransliterator *self,
+					const gchar            *input,
+					gsize                   len)
+{
+  TransliteratorTable *table = TRANSLITERATOR_TABLE (self);
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    if (table->first_bytes[(guchar) input[i]])
+      return TRUE;
+  return FALSE;
+}
+
+static void
+transliterator_table_finalize (GObject *object)
+{
+  TransliteratorTable *table = TRANSLITERATOR_TABLE (object);
+
+  if (table->file)
+    g_mapped_file_unref (table->file);
+
+  G_OBJECT_CLASS (transliterator_table_parent_class)->finalize (object);
+}
+
+static void
+transliterator_table_class_init (TransliteratorTableClass *klass)
+{
+  TranslitTransliteratorClass *transliterator_class = TRANSLIT_TRANSLITERATOR_CLASS (klass);
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  transliterator_class->transliterate_full =
+    transliterator_table_real_transliterate_full;
+  transliterator_class->would_change =
+    transliterator_table_real_would_change;
+
+  gobject_class->finalize = transliterator_table_finalize;
+}
+
+static void
+transliterator_table_class_finalize (TransliteratorTableClass *klass)
+{
+}
+
+static void
+transliterator_table_init (TransliteratorTable *self)
+{
+}
+
+/* Find the compiled table for NAME, in the directories listed in
+ * TRANSLIT_TABLE_PATH, or in TABLEDIR.  */
+static gchar *
+find_table (const gchar *name)
+{
+  const gchar *table_path;
+  gchar **paths, *basename, *filename = NULL;
+  gint i;
+
+  if (g_path_is_absolute (name))
+    return g_strdup (name);
+
+  table_path = g_getenv ("TRANSLIT_TABLE_PATH");
+  if (table_path == NULL)
+    table_path = TABLEDIR;
+
+  basename = g_strconcat (name, ".table", NULL);
+  paths = g_strsplit (table_path, G_SEARCHPATH_SEPARATOR_S, -1);
+  for (i = 0; paths[i] != NULL; i++)
+    {
+      filename = g_build_filename (paths[i], basename, NULL);
+      if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+	break;
+      g_free (filename);
+      filename = NULL;
+    }
+  g_strfreev (paths);
+  g_free (basename);
+
+  return filename;
+}
+
+static gboolean
+initable_init (GInitable *initable,
+	       GCancellable *cancellable,
+	       GError **error)
+{
+  TransliteratorTable *table = TRANSLITERATOR_TABLE (initable);
+  const TableHeader *header;
+  const gchar *contents;
+  gchar *name, *filename;
+  gsize length;
+  gint c;
+
+  g_object_get (G_OBJECT (initable),
+		"name", &name,
+		NULL);
+
+  filename = find_table (name);
+  g_free (name);
+  if (filename == NULL)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_LOAD_FAILED,
+		   "can't find table");
+      return FALSE;
+    }
+
+  table->file = g_mapped_file_new (filename, FALSE, error);
+  g_free (filename);
+  if (table->file == NULL)
+    return FALSE;
+
+  contents = g_mapped_file_get_contents (table->file);
+  length = g_mapped_file_get_length (table->file);
+
+  header = (const TableHeader *) contents;
+  if (length < sizeof (TableHeader)
+      || memcmp (header->magic, TABLE_MAGIC, sizeof (header->magic)) != 0
+      || header->version != TABLE_VERSION
+      || header->byte_order != TABLE_BYTE_ORDER
+      || header->n_states == 0
+      || (length - sizeof (TableHeader)) / 12 < header->n_states
+      || length - sizeof (TableHeader) - header->n_states * (gsize) 12
+      != header->pool_size)
+    {
+      g_set_error (error,
+		   TRANSLIT_ERROR,
+		   TRANSLIT_ERROR_LOAD_FAILED,
+		   "invalid table");
+      return FALSE;
+    }
+
+  table->n_states = header->n_states;
+  table->pool_size = header->pool_size;
+  table->base = (const gint32 *) (header + 1);
+  table->check = table->base + table->n_states;
+  table->value = (const guint32 *) (table->check + table->n_states);
+  table->pool = (const guchar *) (table->value + table->n_states);
+
+  for (c = 0; c < 256; c++)
+    table->first_bytes[c] = next_state (table, 0, c) > 0;
+
+  return TRUE;
+}
+
+static void
+initable_iface_init (GInitableIface *initable_iface)
+{
+  initable_iface->init = initable_init;
+}
+
+void
+transliterator_table_register (GTypeModule *module)
+{
+  transliterator_table_register_type (module);
+  translit_implement_transliterator ("table",
+				     transliterator_table_get_type ());
+}
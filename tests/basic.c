@@ -18,7 +18,11 @@
 
 #include "config.h"
 #include <libtranslit/translit.h>
+#include <glib/gstdio.h>
 #include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 static void
 basic_load (void)
@@ -79,7 +83,6 @@ basic_m17n (void)
       g_assert_cmpstr (output, ==, "ो");
 
       g_free (output);
-      g_object_unref (transliterator);
     }
 
   error = NULL;
@@ -103,7 +106,6 @@ basic_m17n (void)
       g_assert_cmpstr (output, ==, "øåéæaa");
 
       g_free (output);
-      g_object_unref (transliterator);
     }
 
   error = NULL;
@@ -137,7 +139,17 @@ basic_m17n (void)
       g_assert_cmpstr (output, ==, "å");
 
       g_free (output);
-      g_object_unref (transliterator);
+
+      /* Keys which the input method ignores, around a mapped one.  */
+      output = translit_transliterator_transliterate (transliterator,
+						      "12, a/ 34",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (endpos, ==, 9);
+      g_assert_cmpstr (output, ==, "12, å 34");
+
+      g_free (output);
     }
 
   error = NULL;
@@ -171,7 +183,6 @@ basic_m17n (void)
       g_assert_cmpstr (output, ==, "かきくけk");
 
       g_free (output);
-      g_object_unref (transliterator);
     }
 }
 
@@ -262,7 +273,6 @@ basic_icu (void)
       g_assert_cmpstr (output, ==, "タチテツテ");
 
       g_free (output);
-      g_object_unref (transliterator);
     }
 
   error = NULL;
@@ -297,7 +307,6 @@ basic_icu (void)
 
       g_free (output);
 
-      g_object_unref (transliterator);
     }
 
   error = NULL;
@@ -332,7 +341,6 @@ basic_icu (void)
 
       g_free (output);
 
-      g_object_unref (transliterator);
     }
 
   error = NULL;
@@ -367,11 +375,1257 @@ basic_icu (void)
 
       g_free (output);
 
-      g_object_unref (transliterator);
     }
 
 }
 
+static void
+basic_batch (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      const gchar *inputs[] = { "aiueo", "kakikukeko", "", NULL };
+      const gchar *invalid_inputs[] = { "aiueo", "\xff", NULL };
+      gchar **outputs;
+      guint *endpos;
+
+      outputs = translit_transliterator_transliterate_batch (transliterator,
+							     inputs,
+							     -1,
+							     &endpos,
+							     &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (g_strv_length (outputs), ==, 3);
+      g_assert_cmpstr (outputs[0], ==, "あいうえお");
+      g_assert_cmpint (endpos[0], ==, 5);
+      g_assert_cmpstr (outputs[1], ==, "かきくけこ");
+      g_assert_cmpint (endpos[1], ==, 10);
+      g_assert_cmpstr (outputs[2], ==, "");
+      g_assert_cmpint (endpos[2], ==, 0);
+
+      g_strfreev (outputs);
+      g_free (endpos);
+
+      outputs = translit_transliterator_transliterate_batch (transliterator,
+							     invalid_inputs,
+							     -1,
+							     NULL,
+							     &error);
+      g_assert_error (error,
+		      TRANSLIT_ERROR,
+		      TRANSLIT_ERROR_INVALID_INPUT);
+      g_assert (outputs == NULL);
+      g_error_free (error);
+    }
+}
+
+static void
+basic_append (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      GString *output;
+      guint endpos;
+      gboolean retval;
+
+      output = g_string_new ("<");
+      retval = translit_transliterator_transliterate_append (transliterator,
+							     "aiueoka",
+							     5,
+							     output,
+							     &endpos,
+							     &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      g_assert_cmpint (endpos, ==, 5);
+      g_assert_cmpstr (output->str, ==, "<あいうえお");
+
+      /* Cut in the middle of a multibyte character.  */
+      retval = translit_transliterator_transliterate_append (transliterator,
+							     "あ",
+							     2,
+							     output,
+							     &endpos,
+							     &error);
+      g_assert_error (error,
+		      TRANSLIT_ERROR,
+		      TRANSLIT_ERROR_INVALID_INPUT);
+      g_assert (!retval);
+      g_assert_cmpstr (output->str, ==, "<あいうえお");
+      g_error_free (error);
+
+      g_string_free (output, TRUE);
+    }
+}
+
+static void
+basic_converter (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitConverter *converter;
+      const gchar *input = "aiueo kakikukeko\nka";
+      gsize input_len = strlen (input), bytes_read, bytes_written;
+      GString *output;
+      GConverterResult result;
+
+      converter = translit_converter_new (transliterator);
+      output = g_string_new (NULL);
+
+      /* Feed the input and read the output in small pieces.  */
+      do
+	{
+	  gchar outbuf[4];
+	  gsize inbuf_size = MIN (input_len, 3);
+
+	  result = g_converter_convert (G_CONVERTER (converter),
+					input, inbuf_size,
+					outbuf, sizeof (outbuf),
+					inbuf_size == input_len
+					? G_CONVERTER_INPUT_AT_END
+					: G_CONVERTER_NO_FLAGS,
+					&bytes_read, &bytes_written,
+					&error);
+	  if (result == G_CONVERTER_ERROR)
+	    {
+	      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+	      g_clear_error (&error);
+	      continue;
+	    }
+	  input += bytes_read;
+	  input_len -= bytes_read;
+	  g_string_append_len (output, outbuf, bytes_written);
+	}
+      while (result != G_CONVERTER_FINISHED);
+
+      g_assert_cmpstr (output->str, ==, "あいうえお かきくけこ\nか");
+
+      g_string_free (output, TRUE);
+      g_object_unref (converter);
+    }
+}
+
+static void
+basic_session (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitSession *session;
+      GString *committed;
+      const gchar *keys[] = { "k", "a", "k", "i", "k", "u", "k", "e", "k" };
+      guint i;
+      gboolean retval;
+
+      session = translit_session_new (transliterator);
+      committed = g_string_new (NULL);
+
+      for (i = 0; i < G_N_ELEMENTS (keys); i++)
+	{
+	  retval = translit_session_append (session, keys[i], -1,
+					    committed,
+					    &error);
+	  g_assert_no_error (error);
+	  g_assert (retval);
+	}
+      g_assert (g_str_has_prefix ("かきくけ", committed->str));
+      g_assert_cmpstr (translit_session_get_pending (session), !=, "");
+
+      retval = translit_session_finish (session, committed, &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      g_assert_cmpstr (committed->str, ==, "かきくけく");
+      g_assert_cmpstr (translit_session_get_pending (session), ==, "");
+
+      g_string_free (committed, TRUE);
+      g_object_unref (session);
+    }
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("m17n", "t-latn-post",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitSession *session;
+      GString *committed;
+      gboolean retval;
+
+      session = translit_session_new (transliterator);
+      committed = g_string_new (NULL);
+
+      retval = translit_session_append (session, "a", -1, committed, &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      retval = translit_session_append (session, "/", -1, committed, &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      retval = translit_session_finish (session, committed, &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      g_assert_cmpstr (committed->str, ==, "å");
+
+      g_string_free (committed, TRUE);
+      g_object_unref (session);
+    }
+
+  /* Text without whitespace is not buffered without limit.  */
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitSession *session;
+      GString *committed, *expected;
+      gboolean retval;
+      guint i;
+
+      session = translit_session_new (transliterator);
+      committed = g_string_new (NULL);
+      expected = g_string_new (NULL);
+
+      for (i = 0; i < 2000; i++)
+	{
+	  retval = translit_session_append (session, "日本", -1, committed,
+					    &error);
+	  g_assert_no_error (error);
+	  g_assert (retval);
+	  g_assert_cmpint (strlen (translit_session_get_pending (session)),
+			   <=, 1024);
+	  g_string_append (expected, "日本");
+	}
+      retval = translit_session_finish (session, committed, &error);
+      g_assert_no_error (error);
+      g_assert (retval);
+      g_assert_cmpstr (committed->str, ==, expected->str);
+
+      g_string_free (expected, TRUE);
+      g_string_free (committed, TRUE);
+      g_object_unref (session);
+    }
+}
+
+static gpointer
+get_thread (gpointer data)
+{
+  return translit_transliterator_get ("icu", "Latin-Cyrillic", NULL);
+}
+
+static void
+basic_registry (void)
+{
+  TranslitTransliterator *transliterator;
+  GThread *threads[4];
+  GQuark id;
+  GError *error;
+  guint i;
+
+  /* Concurrent lookups of the same transliterator must end up with
+     the same instance.  */
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    threads[i] = g_thread_new ("get", get_thread, NULL);
+
+  transliterator = g_thread_join (threads[0]);
+  g_assert (transliterator != NULL);
+  for (i = 1; i < G_N_ELEMENTS (threads); i++)
+    g_assert (g_thread_join (threads[i]) == transliterator);
+
+  error = NULL;
+  id = translit_transliterator_id ("icu", "Latin-Cyrillic");
+  g_assert (translit_transliterator_get_by_id (id, &error) == transliterator);
+  g_assert_no_error (error);
+
+  id = translit_transliterator_id ("icu", "Latin-Greek");
+  transliterator = translit_transliterator_get_by_id (id, &error);
+  g_assert_no_error (error);
+  g_assert (transliterator == translit_transliterator_get ("icu",
+							   "Latin-Greek",
+							   &error));
+  g_assert_no_error (error);
+}
+
+static void
+basic_pool (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitPool *pool;
+      TranslitTransliterator *a, *b, *c;
+      gchar *output;
+
+      pool = translit_pool_new (transliterator, 2);
+
+      a = translit_pool_acquire (pool, &error);
+      g_assert_no_error (error);
+      b = translit_pool_acquire (pool, &error);
+      g_assert_no_error (error);
+      g_assert (a != b);
+      g_assert (a != transliterator && b != transliterator);
+
+      output = translit_transliterator_transliterate (b, "ka", NULL, &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (output, ==, "か");
+      g_free (output);
+
+      translit_pool_release (pool, a);
+      c = translit_pool_acquire (pool, &error);
+      g_assert_no_error (error);
+      g_assert (c == a);
+
+      translit_pool_release (pool, b);
+      translit_pool_release (pool, c);
+      translit_pool_unref (pool);
+    }
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("m17n", "hi-inscript",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitTransliterator *clone;
+      gchar *output;
+      guint endpos;
+
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      output = translit_transliterator_transliterate (clone,
+						      "a",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (endpos, ==, 1);
+      g_assert_cmpstr (output, ==, "ो");
+
+      g_free (output);
+      g_object_unref (clone);
+    }
+}
+
+static void
+basic_parallel (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      GString *input;
+      gchar *expected, *output;
+      guint expected_endpos, endpos;
+      gint i;
+
+      /* Large enough to be split into several pieces, with characters
+       * outside of the BMP, which ICU counts as two.  */
+      input = g_string_new (NULL);
+      for (i = 0; i < 50000; i++)
+	g_string_append (input, "kakikukeko😀\n");
+
+      expected = translit_transliterator_transliterate (transliterator,
+							input->str,
+							&expected_endpos,
+							&error);
+      g_assert_no_error (error);
+
+      output = translit_transliterator_transliterate_parallel
+	(transliterator,
+	 input->str, input->len,
+	 TRANSLIT_SPLIT_LINE,
+	 4,
+	 &endpos,
+	 &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (output, ==, expected);
+      g_assert_cmpint (endpos, ==, expected_endpos);
+      g_free (output);
+
+      output = translit_transliterator_transliterate_parallel
+	(transliterator,
+	 "ka ki", -1,
+	 TRANSLIT_SPLIT_WHITESPACE,
+	 0,
+	 &endpos,
+	 &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (output, ==, "か き");
+      g_assert_cmpint (endpos, ==, 5);
+      g_free (output);
+
+      g_free (expected);
+      g_string_free (input, TRUE);
+    }
+}
+
+static void
+basic_would_change (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  /* The keys of a table are exactly the text it may change.  */
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      g_assert (!translit_transliterator_would_change (transliterator,
+						       "日本語",
+						       -1));
+      g_assert (translit_transliterator_would_change (transliterator,
+						      "日本語 ka",
+						      -1));
+    }
+
+  /* ICU only guesses the source set of compound transliterators,
+   * e.g. that of Latin-Katakana lists only fullwidth Latin.  */
+  transliterator = translit_transliterator_get ("icu", "Latin-Katakana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    g_assert (translit_transliterator_would_change (transliterator,
+						    "aiueo",
+						    -1));
+
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      GString *input;
+      gchar *output;
+      gint i;
+
+      g_assert (translit_transliterator_would_change (transliterator,
+						      "日本語 ka",
+						      -1));
+
+      /* Text around the affected characters is left as is.  */
+      input = g_string_new (NULL);
+      for (i = 0; i < 100; i++)
+	g_string_append (input, "日本語");
+      g_string_append (input, "kana");
+      for (i = 0; i < 100; i++)
+	g_string_append (input, "日本語");
+
+      output = translit_transliterator_transliterate (transliterator,
+						      input->str,
+						      NULL,
+						      &error);
+      g_assert_no_error (error);
+      g_string_truncate (input, 0);
+      for (i = 0; i < 100; i++)
+	g_string_append (input, "日本語");
+      g_string_append (input, "かな");
+      for (i = 0; i < 100; i++)
+	g_string_append (input, "日本語");
+      g_assert_cmpstr (output, ==, input->str);
+      g_free (output);
+      g_string_free (input, TRUE);
+    }
+}
+
+static void
+basic_cache (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Latin-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitTransliterator *clone;
+      gchar *output;
+      guint endpos;
+      guint64 hits, misses;
+      gint i;
+
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      translit_transliterator_set_cache_size (clone, 16, 0);
+      for (i = 0; i < 2; i++)
+	{
+	  output = translit_transliterator_transliterate (clone,
+							  "kana",
+							  &endpos,
+							  &error);
+	  g_assert_no_error (error);
+	  g_assert_cmpint (endpos, ==, 4);
+	  g_assert_cmpstr (output, ==, "かな");
+	  g_free (output);
+	}
+
+      translit_transliterator_get_cache_stats (clone, &hits, &misses);
+      g_assert_cmpint (hits, ==, 1);
+      g_assert_cmpint (misses, ==, 1);
+
+      /* Many more inputs than the cache can hold.  */
+      for (i = 0; i < 100; i++)
+	{
+	  gchar *input = g_strdup_printf ("ka%d", i);
+
+	  output = translit_transliterator_transliterate (clone,
+							  input,
+							  NULL,
+							  &error);
+	  g_assert_no_error (error);
+	  g_assert (g_str_has_prefix (output, "か"));
+	  g_free (output);
+	  g_free (input);
+	}
+
+      g_object_unref (clone);
+    }
+
+  /* The limits apply to the whole cache, not to each of its parts.  */
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitTransliterator *clone;
+      GString *input;
+      gchar *output;
+      guint64 hits, misses;
+      gint i, j;
+
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      /* At most 4 of the 10 inputs are still cached after the first
+       * pass, and each miss of the second pass evicts one of them.  */
+      translit_transliterator_set_cache_size (clone, 4, 0);
+      for (i = 0; i < 2; i++)
+	for (j = 0; j < 10; j++)
+	  {
+	    gchar *key = g_strdup_printf ("ka%d", j);
+
+	    output = translit_transliterator_transliterate (clone, key,
+							    NULL, &error);
+	    g_assert_no_error (error);
+	    g_free (output);
+	    g_free (key);
+	  }
+
+      translit_transliterator_get_cache_stats (clone, &hits, &misses);
+      g_assert_cmpint (hits, <=, 4);
+      g_assert_cmpint (hits + misses, ==, 20);
+
+      /* A result smaller than the byte limit is cached, even if it
+       * is larger than the share of a single part.  */
+      translit_transliterator_set_cache_size (clone, 16, 1024);
+      input = g_string_new (NULL);
+      for (i = 0; i < 100; i++)
+	g_string_append (input, "ka");
+      for (i = 0; i < 2; i++)
+	{
+	  output = translit_transliterator_transliterate (clone, input->str,
+							  NULL, &error);
+	  g_assert_no_error (error);
+	  g_free (output);
+	}
+      g_string_free (input, TRUE);
+
+      translit_transliterator_get_cache_stats (clone, &hits, &misses);
+      g_assert_cmpint (hits, ==, 1);
+      g_assert_cmpint (misses, ==, 1);
+
+      g_object_unref (clone);
+    }
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("m17n", "t-latn-post",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      guint64 hits, misses;
+      gchar *output;
+
+      g_assert (translit_transliterator_get_flags (transliterator)
+		& TRANSLIT_TRANSLITERATOR_FLAG_UNCACHEABLE);
+
+      translit_transliterator_set_cache_size (transliterator, 16, 0);
+      output = translit_transliterator_transliterate (transliterator,
+						      "a/",
+						      NULL,
+						      &error);
+      g_assert_no_error (error);
+      g_free (output);
+
+      translit_transliterator_get_cache_stats (transliterator,
+					       &hits, &misses);
+      g_assert_cmpint (hits, ==, 0);
+      g_assert_cmpint (misses, ==, 0);
+    }
+}
+
+static void
+basic_cache_tokens (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("icu", "Hiragana-Katakana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitTransliterator *clone;
+      gchar *output;
+      guint endpos;
+      guint64 hits, misses;
+
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      translit_transliterator_set_cache_size (clone, 64, 0);
+      translit_transliterator_set_cache_mode (clone, TRANSLIT_CACHE_TOKENS);
+
+      output = translit_transliterator_transliterate (clone,
+						      "かな かな、かな",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (endpos, ==, 8);
+      g_assert_cmpstr (output, ==, "カナ カナ、カナ");
+      g_free (output);
+
+      g_assert (translit_transliterator_get_flags (clone)
+		& TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS);
+      translit_transliterator_get_cache_stats (clone, &hits, &misses);
+      g_assert_cmpint (hits, ==, 2);
+      g_assert_cmpint (misses, ==, 3);
+
+      g_object_unref (clone);
+    }
+
+  /* The apostrophe is the context of "n" in Latin-Katakana, so words
+   * must not be split at it.  */
+  transliterator = translit_transliterator_get ("icu", "Latin-Katakana",
+						&error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      TranslitTransliterator *clone;
+      gchar *output;
+      guint endpos;
+
+      g_assert (!(translit_transliterator_get_flags (transliterator)
+		  & TRANSLIT_TRANSLITERATOR_FLAG_CONTEXT_FREE_TOKENS));
+
+      output = translit_transliterator_transliterate (transliterator,
+						      "kan'i",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (output, ==, "カンイ");
+      g_free (output);
+
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      translit_transliterator_set_cache_size (clone, 64, 0);
+      translit_transliterator_set_cache_mode (clone, TRANSLIT_CACHE_TOKENS);
+
+      output = translit_transliterator_transliterate (clone,
+						      "kan'i",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpstr (output, ==, "カンイ");
+      g_free (output);
+
+      g_object_unref (clone);
+    }
+}
+
+static void
+basic_table (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+  gchar *output;
+  guint endpos;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      /* The longest key wins, and "x", which no key starts with, is
+       * copied.  */
+      output = translit_transliterator_transliterate (transliterator,
+						      "kyakixn",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (endpos, ==, 7);
+      g_assert_cmpstr (output, ==, "きゃきxん");
+      g_free (output);
+
+      output = translit_transliterator_transliterate (transliterator,
+						      "日本k",
+						      &endpos,
+						      &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (endpos, ==, 3);
+      g_assert_cmpstr (output, ==, "日本k");
+      g_free (output);
+
+      g_assert (!translit_transliterator_would_change (transliterator,
+						       "日本語", -1));
+      g_assert (translit_transliterator_would_change (transliterator,
+						      "日本語 ka", -1));
+    }
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "nonexistent",
+						&error);
+  g_assert_error (error,
+		  TRANSLIT_ERROR,
+		  TRANSLIT_ERROR_LOAD_FAILED);
+  g_error_free (error);
+}
+
+static void
+basic_utf8 (void)
+{
+  static const gchar *invalid[] = {
+    "\xc0\xaf",		/* overlong */
+    "\xed\xa0\x80",		/* surrogate */
+    "\xf4\x90\x80\x80",	/* beyond U+10FFFF */
+    "ka\xe3\x81",		/* truncated */
+    "\xff"
+  };
+  TranslitTransliterator *transliterator, *trusted;
+  GString *input, *output;
+  gchar *expected;
+  GError *error;
+  guint endpos;
+  guint i;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      gchar *result;
+
+      result = translit_transliterator_transliterate (transliterator,
+						      invalid[i],
+						      &endpos,
+						      &error);
+      g_assert_error (error, TRANSLIT_ERROR, TRANSLIT_ERROR_INVALID_INPUT);
+      g_assert (result == NULL);
+      g_clear_error (&error);
+    }
+
+  /* Long runs of ASCII go through the vectorized path, and the
+   * characters around them through the scalar one.  */
+  input = g_string_new (NULL);
+  for (i = 0; i < 100; i++)
+    g_string_append (input,
+		     "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789ABCD 日本\xf0\x9f\x98\x80 ");
+  g_string_append (input, "kya");
+
+  output = g_string_new (NULL);
+  g_assert (translit_transliterator_transliterate_append (transliterator,
+							  input->str,
+							  input->len,
+							  output,
+							  &endpos,
+							  &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (endpos, ==, 100 * 45 + 3);
+  g_assert (g_str_has_suffix (output->str, "😀 きゃ"));
+
+  /* A nul stops the input only if the length is not given.  */
+  g_assert (!translit_transliterator_transliterate_append (transliterator,
+							   "ka\0ki", 5,
+							   output,
+							   &endpos,
+							   &error));
+  g_assert_error (error, TRANSLIT_ERROR, TRANSLIT_ERROR_INVALID_INPUT);
+  g_clear_error (&error);
+
+  trusted = translit_transliterator_clone (transliterator, &error);
+  g_assert_no_error (error);
+  translit_transliterator_set_trusted_input (trusted, TRUE);
+
+  expected = g_strdup (output->str);
+  g_string_truncate (output, 0);
+  g_assert (translit_transliterator_transliterate_append (trusted,
+							  input->str,
+							  -1,
+							  output,
+							  &endpos,
+							  &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (endpos, ==, 100 * 45 + 3);
+  g_assert_cmpstr (output->str, ==, expected);
+
+  g_free (expected);
+  g_string_free (output, TRUE);
+  g_string_free (input, TRUE);
+  g_object_unref (trusted);
+}
+
+static void
+basic_result (void)
+{
+  TranslitTransliterator *transliterator;
+  TranslitResult *result;
+  const TranslitAlignmentRun *runs;
+  GString *output;
+  GError *error;
+  gsize input_start, input_end;
+  guint n_runs;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      output = g_string_new (NULL);
+      result = translit_result_new (TRANSLIT_RESULT_ALIGNMENT);
+      g_assert (translit_transliterator_transliterate_full (transliterator,
+							    "xkyaki日本n", -1,
+							    output,
+							    result,
+							    &error));
+      g_assert_no_error (error);
+      g_assert_cmpstr (output->str, ==, "xきゃき日本ん");
+      g_assert_cmpint (translit_result_get_endpos (result), ==, 9);
+      g_assert_cmpint (translit_result_get_end_offset (result), ==, 13);
+
+      runs = translit_result_get_runs (result, &n_runs);
+      g_assert_cmpint (n_runs, ==, 5);
+      g_assert_cmpint (runs[1].input_length, ==, 3);
+      g_assert_cmpint (runs[1].output_length, ==, 6);
+      g_assert_cmpint (runs[3].input_length, ==, 6);
+      g_assert_cmpint (runs[3].output_length, ==, 6);
+
+      /* "き" comes from "ki", and "ゃき" from "kyaki".  */
+      g_assert (translit_result_map_output_span (result, 7, 10,
+						 &input_start, &input_end));
+      g_assert_cmpint (input_start, ==, 4);
+      g_assert_cmpint (input_end, ==, 6);
+      g_assert (translit_result_map_output_span (result, 4, 10,
+						 &input_start, &input_end));
+      g_assert_cmpint (input_start, ==, 1);
+      g_assert_cmpint (input_end, ==, 6);
+      g_assert (!translit_result_map_output_span (result, 10, 100, NULL, NULL));
+
+      /* On error, the result is cleared.  */
+      g_assert (!translit_transliterator_transliterate_full (transliterator,
+							     "ka\xff", -1,
+							     output,
+							     result,
+							     &error));
+      g_assert_error (error, TRANSLIT_ERROR, TRANSLIT_ERROR_INVALID_INPUT);
+      g_clear_error (&error);
+      runs = translit_result_get_runs (result, &n_runs);
+      g_assert_cmpint (n_runs, ==, 0);
+      translit_result_unref (result);
+
+      /* Without the alignment, only the ending position is recorded.  */
+      result = translit_result_new (TRANSLIT_RESULT_FLAGS_NONE);
+      g_string_truncate (output, 0);
+      g_assert (translit_transliterator_transliterate_full (transliterator,
+							    "日本語", -1,
+							    output,
+							    result,
+							    &error));
+      g_assert_no_error (error);
+      g_assert_cmpint (translit_result_get_end_offset (result), ==, 9);
+      g_assert (translit_result_get_runs (result, &n_runs) == NULL);
+      g_assert (!translit_result_map_output_span (result, 0, 3, NULL, NULL));
+      translit_result_unref (result);
+
+      g_string_free (output, TRUE);
+    }
+}
+
+static void
+basic_chain (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+  gchar *output;
+  guint endpos;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("chain",
+						"table:test|icu:Hiragana-Katakana",
+						&error);
+  g_assert_no_error (error);
+
+  output = translit_transliterator_transliterate (transliterator,
+						  "kyakixn",
+						  &endpos,
+						  &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (endpos, ==, 7);
+  g_assert_cmpstr (output, ==, "キャキxン");
+  g_free (output);
+
+  g_assert (translit_transliterator_would_change (transliterator,
+						  "ka", -1));
+
+  /* The two ICU stages are run as a single compound transliterator.  */
+  transliterator = translit_transliterator_get ("chain",
+						"icu:Latin-Katakana|icu:Katakana-Hiragana",
+						&error);
+  g_assert_no_error (error);
+
+  output = translit_transliterator_transliterate (transliterator,
+						  "aiueo",
+						  &endpos,
+						  &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (output, ==, "あいうえお");
+  g_free (output);
+
+  transliterator = translit_transliterator_get ("chain", "table", &error);
+  g_assert_error (error,
+		  TRANSLIT_ERROR,
+		  TRANSLIT_ERROR_LOAD_FAILED);
+  g_clear_error (&error);
+
+  transliterator = translit_transliterator_get ("chain",
+						"table:test|nonexistent:test",
+						&error);
+  g_assert_error (error,
+		  TRANSLIT_ERROR,
+		  TRANSLIT_ERROR_NO_SUCH_BACKEND);
+  g_error_free (error);
+}
+
+static void
+basic_arena (void)
+{
+  TranslitTransliterator *transliterator;
+  TranslitArena *arena;
+  const gchar *inputs[] = { "kya", "kixn", "日本", NULL };
+  const gchar *invalid_inputs[] = { "ka", "\xff", NULL };
+  const gchar *icu_inputs[] = { "aiueo", NULL };
+  GError *error;
+  gchar **outputs, *output;
+  guint *endpos, pos;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  /* Use small chunks, so that the outputs span several of them.  */
+  arena = translit_arena_new (64);
+
+  outputs = translit_transliterator_transliterate_batch_arena (transliterator,
+							       inputs,
+							       -1,
+							       &endpos,
+							       arena,
+							       &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (outputs[0], ==, "きゃ");
+  g_assert_cmpstr (outputs[1], ==, "きxん");
+  g_assert_cmpstr (outputs[2], ==, "日本");
+  g_assert (outputs[3] == NULL);
+  g_assert_cmpint (endpos[0], ==, 3);
+  g_assert_cmpint (endpos[1], ==, 4);
+  g_assert_cmpint (endpos[2], ==, 2);
+
+  output = translit_transliterator_transliterate_arena (transliterator,
+							"kakin", -1,
+							&pos,
+							arena,
+							&error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (output, ==, "かきん");
+  g_assert_cmpint (pos, ==, 5);
+
+  /* The earlier outputs are still there.  */
+  g_assert_cmpstr (outputs[1], ==, "きxん");
+
+  outputs = translit_transliterator_transliterate_batch_arena (transliterator,
+							       invalid_inputs,
+							       -1,
+							       NULL,
+							       arena,
+							       &error);
+  g_assert_error (error,
+		  TRANSLIT_ERROR,
+		  TRANSLIT_ERROR_INVALID_INPUT);
+  g_clear_error (&error);
+  g_assert (outputs == NULL);
+
+  /* A large block gets a chunk of its own.  */
+  memset (translit_arena_alloc (arena, 1000), 0, 1000);
+  g_assert_cmpint (translit_arena_get_size (arena), >=, 1064);
+
+  translit_arena_reset (arena);
+  g_assert_cmpint (translit_arena_get_size (arena), <=, 64);
+
+  transliterator = translit_transliterator_get ("icu", "Latin-Katakana",
+						&error);
+  g_assert_no_error (error);
+
+  outputs = translit_transliterator_transliterate_batch_arena (transliterator,
+							       icu_inputs,
+							       -1,
+							       NULL,
+							       arena,
+							       &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (outputs[0], ==, "アイウエオ");
+
+  translit_arena_unref (arena);
+}
+
+static void
+basic_module_cache (void)
+{
+  const gchar *module_path;
+  gchar **paths, *filename, *module, *directory, *bogus;
+  GKeyFile *cache;
+  GError *error;
+
+  module_path = g_getenv ("TRANSLIT_MODULE_PATH");
+  if (module_path == NULL)
+    return;
+
+  paths = g_strsplit (module_path, G_SEARCHPATH_SEPARATOR_S, 0);
+
+  error = NULL;
+  translit_update_module_cache (paths[0], &error);
+  g_assert_no_error (error);
+
+  filename = g_build_filename (paths[0], "modules.cache", NULL);
+  cache = g_key_file_new ();
+  g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, &error);
+  g_assert_no_error (error);
+  module = g_key_file_get_string (cache, "table", "Module", &error);
+  g_assert_no_error (error);
+  g_assert (g_str_has_prefix (module, "libtranslittable.")
+	    || g_str_has_prefix (module, "translittable."));
+  g_free (module);
+  g_key_file_free (cache);
+
+  g_unlink (filename);
+  g_free (filename);
+  g_strfreev (paths);
+
+  /* With the cache written by translit_update_module_cache(), a
+   * backend which it does not list is not looked for in the
+   * directory, even if a module file of that name exists there.  */
+  directory = g_build_filename (g_get_tmp_dir (),
+				"translit-modules-XXXXXX",
+				NULL);
+  g_assert (g_mkdtemp (directory) != NULL);
+
+  bogus = g_build_filename (directory, "libtranslitbogus.so", NULL);
+  g_file_set_contents (bogus, "", 0, &error);
+  g_assert_no_error (error);
+
+  /* Loading the bogus module fails with a message, so write the
+   * cache in a child process.  */
+  if (g_test_trap_fork (0, G_TEST_TRAP_SILENCE_STDERR))
+    {
+      g_assert (translit_update_module_cache (directory, NULL));
+      exit (0);
+    }
+  g_test_trap_assert_passed ();
+
+  filename = g_build_filename (directory, "modules.cache", NULL);
+  g_assert (g_file_test (filename, G_FILE_TEST_IS_REGULAR));
+
+  if (g_test_trap_fork (0, G_TEST_TRAP_SILENCE_STDERR))
+    {
+      g_setenv ("TRANSLIT_MODULE_PATH", directory, TRUE);
+      g_assert (translit_transliterator_get ("bogus", "test", NULL) == NULL);
+      exit (0);
+    }
+  g_test_trap_assert_passed ();
+  g_test_trap_assert_stderr_unmatched ("*Failed to load module*");
+
+  /* Without the cache, the module file is tried.  */
+  g_unlink (filename);
+  if (g_test_trap_fork (0, G_TEST_TRAP_SILENCE_STDERR))
+    {
+      g_setenv ("TRANSLIT_MODULE_PATH", directory, TRUE);
+      g_assert (translit_transliterator_get ("bogus", "test", NULL) == NULL);
+      exit (0);
+    }
+  g_test_trap_assert_passed ();
+  g_test_trap_assert_stderr ("*Failed to load module*");
+
+  g_unlink (bogus);
+  g_rmdir (directory);
+  g_free (bogus);
+  g_free (filename);
+  g_free (directory);
+}
+
+static void
+basic_stats (void)
+{
+  TranslitTransliterator *transliterator, *clone;
+  TranslitTransliteratorStats stats;
+  GError *error;
+  gchar *output, *dump;
+  guint64 n_calls;
+  gint i;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      clone = translit_transliterator_clone (transliterator, &error);
+      g_assert_no_error (error);
+
+      for (i = 0; i < 2; i++)
+	{
+	  output = translit_transliterator_transliterate (clone, "kyakixn",
+							  NULL, &error);
+	  g_assert_no_error (error);
+	  g_free (output);
+	}
+
+      output = translit_transliterator_transliterate (clone, "\xff",
+						      NULL, &error);
+      g_assert_error (error, TRANSLIT_ERROR, TRANSLIT_ERROR_INVALID_INPUT);
+      g_clear_error (&error);
+
+      translit_transliterator_get_stats (clone, &stats);
+#ifdef ENABLE_STATS
+      g_assert_cmpint (stats.calls, ==, 3);
+      g_assert_cmpint (stats.input_bytes, ==, 2 * strlen ("kyakixn") + 1);
+      g_assert_cmpint (stats.output_bytes, ==, 2 * strlen ("きゃきxん"));
+      g_assert_cmpint (stats.errors, ==, 1);
+      g_assert_cmpint (stats.max_ns, <=, stats.total_ns);
+#else
+      g_assert_cmpint (stats.calls, ==, 0);
+#endif
+
+      n_calls = 0;
+      for (i = 0; i < TRANSLIT_STATS_HISTOGRAM_SIZE; i++)
+	n_calls += stats.histogram[i];
+      g_assert_cmpint (n_calls, ==, stats.calls);
+
+      g_object_unref (clone);
+
+      dump = translit_transliterator_dump_stats (TRUE);
+      g_assert (strstr (dump, "table:test calls=") != NULL);
+      g_free (dump);
+    }
+}
+
+static void
+basic_trace (void)
+{
+  TranslitTransliterator *transliterator;
+  GError *error;
+  gchar *output, *filename, *contents;
+  gint fd;
+
+  error = NULL;
+  transliterator = translit_transliterator_get ("table", "test", &error);
+  g_assert_no_error (error);
+
+  if (transliterator)
+    {
+      translit_trace_enable ();
+      output = translit_transliterator_transliterate (transliterator, "ka",
+						      NULL, &error);
+      g_assert_no_error (error);
+      g_free (output);
+      translit_trace_disable ();
+
+      fd = g_file_open_tmp ("translit-trace-XXXXXX.json", &filename, &error);
+      g_assert_no_error (error);
+      close (fd);
+
+      translit_trace_dump (filename, &error);
+      g_assert_no_error (error);
+      g_file_get_contents (filename, &contents, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (g_str_has_prefix (contents, "{"));
+      g_assert (strstr (contents, "\"name\":\"transliterate\"") != NULL);
+      g_assert (strstr (contents, "\"name\":\"backend\"") != NULL);
+      g_assert (strstr (contents, "\"ph\":\"X\"") != NULL);
+      g_free (contents);
+
+      g_unlink (filename);
+      g_free (filename);
+    }
+}
+
 int
 main (int argc, char **argv) {
   setlocale (LC_ALL, "");
@@ -380,5 +1634,23 @@ main (int argc, char **argv) {
   g_test_add_func ("/libtranslit/basic/load", basic_load);
   g_test_add_func ("/libtranslit/basic/m17n", basic_m17n);
   g_test_add_func ("/libtranslit/basic/icu", basic_icu);
+  g_test_add_func ("/libtranslit/basic/batch", basic_batch);
+  g_test_add_func ("/libtranslit/basic/append", basic_append);
+  g_test_add_func ("/libtranslit/basic/converter", basic_converter);
+  g_test_add_func ("/libtranslit/basic/session", basic_session);
+  g_test_add_func ("/libtranslit/basic/registry", basic_registry);
+  g_test_add_func ("/libtranslit/basic/pool", basic_pool);
+  g_test_add_func ("/libtranslit/basic/parallel", basic_parallel);
+  g_test_add_func ("/libtranslit/basic/would-change", basic_would_change);
+  g_test_add_func ("/libtranslit/basic/cache", basic_cache);
+  g_test_add_func ("/libtranslit/basic/cache-tokens", basic_cache_tokens);
+  g_test_add_func ("/libtranslit/basic/table", basic_table);
+  g_test_add_func ("/libtranslit/basic/utf8", basic_utf8);
+  g_test_add_func ("/libtranslit/basic/result", basic_result);
+  g_test_add_func ("/libtranslit/basic/chain", basic_chain);
+  g_test_add_func ("/libtranslit/basic/arena", basic_arena);
+  g_test_add_func ("/libtranslit/basic/module-cache", basic_module_cache);
+  g_test_add_func ("/libtranslit/basic/stats", basic_stats);
+  g_test_add_func ("/libtranslit/basic/trace", basic_trace);
   return g_test_run ();
 }
@@ -0,0 +1,597 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measure the throughput and latency of each backend.  The results
+ * are written as JSON, one result per line, so that the output of a
+ * previous run can be given back with --baseline to detect
+ * regressions.  */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Count the allocations made by the transliterators, including those
+ * of ICU and m17n-lib, by interposing malloc.  */
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static volatile gint n_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_realloc (ptr, size);
+}
+#endif
+
+typedef struct _BenchCase BenchCase;
+
+struct _BenchCase
+{
+  const gchar *backend;
+  const gchar *name;
+  const gchar * const *words;
+};
+
+static const gchar * const latin_words[] = {
+  "watashi", "wa", "no", "ni", "desu", "konnichiwa", "arigatou",
+  "toukyou", "kyouto", "sakura", "yama", "kawa", "gakkou", "sensei",
+  "tomodachi", "shinbun", "denwa", "kyuushuu", "hokkaidou", "shashin",
+  NULL
+};
+
+static const gchar * const cyrillic_words[] = {
+  "и", "в", "не", "на", "что", "привет", "мир", "москва", "время",
+  "человек", "жизнь", "рука", "день", "работа", "слово", "место",
+  "вопрос", "дом", "сторона", "щука", "объявление", "Юрий",
+  NULL
+};
+
+static const gchar * const devanagari_words[] = {
+  "है", "के", "में", "की", "और", "नमस्ते", "भारत", "हिन्दी", "पानी",
+  "किताब", "दुनिया", "समय", "लोग", "काम", "घर", "दिन", "प्यार", "शहर",
+  "सरकार", "ज़िंदगी", "क्षत्रिय",
+  NULL
+};
+
+/* keystrokes of the Inscript layout */
+static const gchar * const inscript_words[] = {
+  "k", "kd", "jh", "hkd", "lkdf", "mjs", "vjd", "pks", "cjd", "hjfk",
+  "kmuh", "ikjr", "yj[", "j;d", "ufi", "dfd", "kjh", "hk", "f;",
+  NULL
+};
+
+/* Danish, with the postfix sequences of da-post */
+static const gchar * const danish_words[] = {
+  "og", "i", "at", "det", "en", "paa", "blaabaer", "smo/rrebro/d",
+  "ko/benhavn", "aebler", "kaere", "groo/d", "so/", "faar", "naar",
+  "braendevin", "hygge",
+  NULL
+};
+
+/* keys of tests/test-table.txt */
+static const gchar * const table_words[] = {
+  "ka", "ki", "kya", "n", "kanki", "kyakin", "nanka", "x", "kix",
+  NULL
+};
+
+static const BenchCase cases[] = {
+  { "icu", "Latin-Katakana", latin_words },
+  { "icu", "Latin-Hiragana", latin_words },
+  { "icu", "Russian-Latin/BGN", cyrillic_words },
+  { "icu", "Devanagari-Latin", devanagari_words },
+  { "m17n", "hi-inscript", inscript_words },
+  { "m17n", "da-post", danish_words },
+  { "table", "test", table_words }
+};
+
+typedef enum {
+  CORPUS_WORD,
+  CORPUS_SENTENCE,
+  CORPUS_PARAGRAPH,
+  CORPUS_UNIFORM
+} CorpusType;
+
+static const gchar * const corpus_names[] = {
+  "word", "sentence", "paragraph", "uniform"
+};
+
+#define PARAGRAPH_SIZE 4096
+
+/* Pick a word with a Zipf distribution, as in natural text, where
+ * the word of rank R appears with a frequency proportional to 1/R.  */
+static const gchar *
+pick_word (GRand *rand, const gchar * const *words, guint n_words)
+{
+  gdouble total = 0.0, x;
+  guint i;
+
+  for (i = 0; i < n_words; i++)
+    total += 1.0 / (i + 1);
+
+  x = g_rand_double (rand) * total;
+  for (i = 0; i < n_words - 1; i++)
+    {
+      x -= 1.0 / (i + 1);
+      if (x < 0)
+	break;
+    }
+  return words[i];
+}
+
+static void
+append_sentence (GString *corpus, GRand *rand,
+		 const gchar * const *words, guint n_words)
+{
+  gint i, n;
+
+  n = g_rand_int_range (rand, 5, 25);
+  for (i = 0; i < n; i++)
+    {
+      if (i > 0)
+	g_string_append (corpus,
+			 g_rand_int_range (rand, 0, 8) == 0 ? ", " : " ");
+      g_string_append (corpus, pick_word (rand, words, n_words));
+    }
+  g_string_append (corpus, ".");
+}
+
+/* Generate a corpus from WORDS.  The generator is seeded, so that the
+ * corpora are the same in every run.  */
+static gchar *
+generate_corpus (const gchar * const *words, CorpusType type)
+{
+  GString *corpus;
+  GRand *rand;
+  guint n_words;
+
+  n_words = g_strv_length ((gchar **) words);
+  rand = g_rand_new_with_seed (12345);
+  corpus = g_string_new (NULL);
+
+  switch (type)
+    {
+    case CORPUS_WORD:
+      g_string_append (corpus, words[n_words / 2]);
+      break;
+    case CORPUS_SENTENCE:
+      append_sentence (corpus, rand, words, n_words);
+      break;
+    case CORPUS_PARAGRAPH:
+      while (corpus->len < PARAGRAPH_SIZE)
+	{
+	  if (corpus->len > 0)
+	    g_string_append (corpus,
+			     g_rand_int_range (rand, 0, 6) == 0 ? "\n" : " ");
+	  append_sentence (corpus, rand, words, n_words);
+	}
+      break;
+    case CORPUS_UNIFORM:
+      while (corpus->len < PARAGRAPH_SIZE)
+	{
+	  if (corpus->len > 0)
+	    g_string_append_c (corpus, ' ');
+	  g_string_append (corpus,
+			   words[g_rand_int_range (rand, 0, n_words)]);
+	}
+      break;
+    }
+
+  g_rand_free (rand);
+  return g_string_free (corpus, FALSE);
+}
+
+static guint64
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static gint
+compare_uint64 (gconstpointer a, gconstpointer b)
+{
+  guint64 va = *(const guint64 *) a, vb = *(const guint64 *) b;
+
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+typedef struct _BenchResult BenchResult;
+
+struct _BenchResult
+{
+  guint n_calls;
+  gdouble mb_per_s;
+  gdouble chars_per_s;
+  gdouble allocs_per_call;
+  guint64 p50_ns;
+  guint64 p99_ns;
+  guint64 p999_ns;
+};
+
+#define MAX_CALLS 1000000
+
+static gboolean
+run_case (TranslitTransliterator *transliterator,
+	  const gchar            *input,
+	  gdouble                 duration,
+	  BenchResult            *result,
+	  GError                **error)
+{
+  GArray *latencies;
+  guint64 start, total = 0;
+  glong n_chars;
+  gsize len;
+  gint n_allocs = 0;
+  gchar *output;
+
+  len = strlen (input);
+  n_chars = g_utf8_strlen (input, len);
+
+  /* warm up the caches and the lazily initialized state */
+  output = translit_transliterator_transliterate (transliterator, input,
+						  NULL, error);
+  if (output == NULL)
+    return FALSE;
+  g_free (output);
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+  start = get_time_ns ();
+  while (latencies->len < MAX_CALLS
+	 && (latencies->len < 100
+	     || get_time_ns () - start < duration * 1e9))
+    {
+      guint64 t0, t1;
+#ifdef COUNT_ALLOCATIONS
+      gint allocs = g_atomic_int_get (&n_allocations);
+#endif
+
+      t0 = get_time_ns ();
+      output = translit_transliterator_transliterate (transliterator, input,
+						      NULL, error);
+      t1 = get_time_ns ();
+
+#ifdef COUNT_ALLOCATIONS
+      n_allocs += g_atomic_int_get (&n_allocations) - allocs;
+#endif
+
+      if (output == NULL)
+	{
+	  g_array_free (latencies, TRUE);
+	  return FALSE;
+	}
+      g_free (output);
+
+      t1 -= t0;
+      total += t1;
+      g_array_append_val (latencies, t1);
+    }
+
+  g_array_sort (latencies, compare_uint64);
+
+  result->n_calls = latencies->len;
+  result->mb_per_s = (gdouble) len * latencies->len / total * 1e9 / 1e6;
+  result->chars_per_s = (gdouble) n_chars * latencies->len / total * 1e9;
+#ifdef COUNT_ALLOCATIONS
+  result->allocs_per_call = (gdouble) n_allocs / latencies->len;
+#else
+  result->allocs_per_call = -1;
+#endif
+  result->p50_ns = g_array_index (latencies, guint64,
+				  latencies->len * 50 / 100);
+  result->p99_ns = g_array_index (latencies, guint64,
+				  latencies->len * 99 / 100);
+  result->p999_ns = g_array_index (latencies, guint64,
+				   latencies->len * 999 / 1000);
+
+  g_array_free (latencies, TRUE);
+  return TRUE;
+}
+
+typedef struct _Baseline Baseline;
+
+struct _Baseline
+{
+  gdouble mb_per_s;
+  guint64 p99_ns;
+};
+
+static gchar *
+make_key (const gchar *backend, const gchar *name, const gchar *corpus)
+{
+  return g_strdup_printf ("%s:%s:%s", backend, name, corpus);
+}
+
+/* Read the output of a previous run.  */
+static GHashTable *
+load_baseline (const gchar *filename, GError **error)
+{
+  GHashTable *baseline;
+  GRegex *regex;
+  gchar *contents, **lines;
+  gint i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return NULL;
+
+  regex = g_regex_new ("\"backend\": \"([^\"]*)\", "
+		       "\"name\": \"([^\"]*)\", "
+		       "\"corpus\": \"([^\"]*)\", "
+		       ".*\"mb_per_s\": ([0-9.eE+-]+), "
+		       ".*\"p99_ns\": ([0-9]+)",
+		       0, 0, NULL);
+  g_assert (regex);
+
+  baseline = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      GMatchInfo *match_info;
+
+      if (g_regex_match (regex, lines[i], 0, &match_info))
+	{
+	  gchar *backend, *name, *corpus, *value;
+	  Baseline *entry;
+
+	  backend = g_match_info_fetch (match_info, 1);
+	  name = g_match_info_fetch (match_info, 2);
+	  corpus = g_match_info_fetch (match_info, 3);
+
+	  entry = g_new0 (Baseline, 1);
+	  value = g_match_info_fetch (match_info, 4);
+	  entry->mb_per_s = g_ascii_strtod (value, NULL);
+	  g_free (value);
+	  value = g_match_info_fetch (match_info, 5);
+	  entry->p99_ns = g_ascii_strtoull (value, NULL, 10);
+	  g_free (value);
+
+	  g_hash_table_insert (baseline,
+			       make_key (backend, name, corpus),
+			       entry);
+	  g_free (backend);
+	  g_free (name);
+	  g_free (corpus);
+	}
+      g_match_info_free (match_info);
+    }
+  g_strfreev (lines);
+  g_regex_unref (regex);
+  g_free (contents);
+
+  return baseline;
+}
+
+static gchar *opt_output = NULL;
+static gchar *opt_baseline = NULL;
+static gchar *opt_filter = NULL;
+static gdouble opt_duration = 0.5;
+static gdouble opt_threshold = 10.0;
+
+static const GOptionEntry entries[] = {
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+    "Write the results to FILE instead of the standard output", "FILE" },
+  { "baseline", 'b', 0, G_OPTION_ARG_FILENAME, &opt_baseline,
+    "Compare the results with the output of a previous run", "FILE" },
+  { "threshold", 't', 0, G_OPTION_ARG_DOUBLE, &opt_threshold,
+    "Report a regression beyond PERCENT (default: 10)", "PERCENT" },
+  { "duration", 'd', 0, G_OPTION_ARG_DOUBLE, &opt_duration,
+    "Run each case for SECONDS (default: 0.5)", "SECONDS" },
+  { "filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter,
+    "Only run the cases whose name contains STRING", "STRING" },
+  { NULL }
+};
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GHashTable *baseline = NULL;
+  GString *json;
+  GError *error = NULL;
+  gboolean first = TRUE;
+  gint n_regressions = 0;
+  guint i, j;
+
+  setlocale (LC_ALL, "");
+
+  context = g_option_context_new ("- measure transliteration speed");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (opt_baseline)
+    {
+      baseline = load_baseline (opt_baseline, &error);
+      if (baseline == NULL)
+	{
+	  g_printerr ("%s: %s\n", opt_baseline, error->message);
+	  g_error_free (error);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  json = g_string_new ("{\n  \"results\": [\n");
+  for (i = 0; i < G_N_ELEMENTS (cases); i++)
+    {
+      TranslitTransliterator *transliterator;
+
+      if (opt_filter && !strstr (cases[i].name, opt_filter)
+	  && !strstr (cases[i].backend, opt_filter))
+	continue;
+
+      transliterator = translit_transliterator_get (cases[i].backend,
+						    cases[i].name,
+						    &error);
+      if (transliterator == NULL)
+	{
+	  g_printerr ("skipping %s:%s: %s\n",
+		      cases[i].backend, cases[i].name, error->message);
+	  g_clear_error (&error);
+	  continue;
+	}
+
+      for (j = 0; j < G_N_ELEMENTS (corpus_names); j++)
+	{
+	  BenchResult result;
+	  gchar *input, buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	  input = generate_corpus (cases[i].words, j);
+	  if (!run_case (transliterator, input, opt_duration, &result, &error))
+	    {
+	      g_printerr ("skipping %s:%s:%s: %s\n",
+			  cases[i].backend, cases[i].name, corpus_names[j],
+			  error->message);
+	      g_clear_error (&error);
+	      g_free (input);
+	      continue;
+	    }
+	  g_free (input);
+
+	  if (!first)
+	    g_string_append (json, ",\n");
+	  first = FALSE;
+
+	  g_string_append_printf (json,
+				  "    { \"backend\": \"%s\", "
+				  "\"name\": \"%s\", "
+				  "\"corpus\": \"%s\", "
+				  "\"calls\": %u, ",
+				  cases[i].backend,
+				  cases[i].name,
+				  corpus_names[j],
+				  result.n_calls);
+	  /* Use the C locale for the decimal point.  */
+	  g_string_append_printf (json, "\"mb_per_s\": %s, ",
+				  g_ascii_formatd (buffer, sizeof (buffer),
+						   "%.3f", result.mb_per_s));
+	  g_string_append_printf (json, "\"chars_per_s\": %s, ",
+				  g_ascii_formatd (buffer, sizeof (buffer),
+						   "%.0f",
+						   result.chars_per_s));
+	  if (result.allocs_per_call < 0)
+	    g_string_append (json, "\"allocs_per_call\": null, ");
+	  else
+	    g_string_append_printf (json, "\"allocs_per_call\": %s, ",
+				    g_ascii_formatd (buffer, sizeof (buffer),
+						     "%.2f",
+						     result.allocs_per_call));
+	  g_string_append_printf (json,
+				  "\"p50_ns\": %" G_GUINT64_FORMAT ", "
+				  "\"p99_ns\": %" G_GUINT64_FORMAT ", "
+				  "\"p999_ns\": %" G_GUINT64_FORMAT,
+				  result.p50_ns,
+				  result.p99_ns,
+				  result.p999_ns);
+
+	  if (baseline)
+	    {
+	      Baseline *entry;
+	      gchar *key;
+
+	      key = make_key (cases[i].backend, cases[i].name,
+			      corpus_names[j]);
+	      entry = g_hash_table_lookup (baseline, key);
+	      g_free (key);
+
+	      if (entry && entry->mb_per_s > 0 && entry->p99_ns > 0)
+		{
+		  gdouble throughput, latency;
+		  gboolean regression;
+
+		  throughput = (result.mb_per_s / entry->mb_per_s - 1) * 100;
+		  latency = ((gdouble) result.p99_ns / entry->p99_ns - 1) * 100;
+		  regression = throughput < -opt_threshold
+		    || latency > opt_threshold;
+		  if (regression)
+		    n_regressions++;
+
+		  g_string_append_printf (json, ", \"mb_per_s_change\": %s",
+					  g_ascii_formatd (buffer,
+							   sizeof (buffer),
+							   "%.1f",
+							   throughput));
+		  g_string_append_printf (json, ", \"p99_ns_change\": %s",
+					  g_ascii_formatd (buffer,
+							   sizeof (buffer),
+							   "%.1f",
+							   latency));
+		  g_string_append_printf (json, ", \"regression\": %s",
+					  regression ? "true" : "false");
+		}
+	    }
+	  g_string_append (json, " }");
+	}
+    }
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+	{
+	  g_printerr ("%s: %s\n", opt_output, error->message);
+	  g_error_free (error);
+	  return EXIT_FAILURE;
+	}
+    }
+  else
+    g_print ("%s", json->str);
+  g_string_free (json, TRUE);
+
+  if (baseline)
+    {
+      g_hash_table_destroy (baseline);
+      if (n_regressions > 0)
+	{
+	  g_printerr ("%d regressions beyond %g%%\n",
+		      n_regressions, opt_threshold);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  return EXIT_SUCCESS;
+}
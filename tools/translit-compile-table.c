@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compile a mapping source into a table for the "table" backend.
+ *
+ * The source has one mapping per line, a key and its output separated
+ * by a tab.  Empty lines and lines starting with '#' are ignored.
+ * Both fields may contain the escapes \\, \t, \n, and \uXXXX.  */
+
+#include "config.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tableformat.h"
+
+typedef struct _Entry Entry;
+
+struct _Entry
+{
+  gchar *key;
+  gchar *value;
+  guint lineno;
+};
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->key);
+  g_free (entry->value);
+  g_slice_free (Entry, entry);
+}
+
+typedef struct _Node Node;
+
+struct _Node
+{
+  guchar label;
+  gint first_child;
+  gint last_child;
+  gint next_sibling;
+  guint32 value;
+};
+
+static gboolean
+unescape (const gchar *str, const gchar *end, GString *output, GError **error)
+{
+  const gchar *p;
+
+  for (p = str; p < end; p++)
+    {
+      if (*p != '\\')
+	{
+	  g_string_append_c (output, *p);
+	  continue;
+	}
+
+      if (++p == end)
+	{
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "trailing backslash");
+	  return FALSE;
+	}
+
+      switch (*p)
+	{
+	case '\\':
+	  g_string_append_c (output, '\\');
+	  break;
+	case 't':
+	  g_string_append_c (output, '\t');
+	  break;
+	case 'n':
+	  g_string_append_c (output, '\n');
+	  break;
+	case 'u':
+	  {
+	    gunichar uc = 0;
+	    gint i;
+
+	    for (i = 0; i < 4; i++)
+	      {
+		if (++p == end || !g_ascii_isxdigit (*p))
+		  {
+		    g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+				 "invalid \\u escape");
+		    return FALSE;
+		  }
+		uc = uc * 16 + g_ascii_xdigit_value (*p);
+	      }
+	    if (uc == 0 || !g_unichar_validate (uc))
+	      {
+		g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+			     "invalid character U+%04X", uc);
+		return FALSE;
+	      }
+	    g_string_append_unichar (output, uc);
+	  }
+	  break;
+	default:
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "unknown escape \\%c", *p);
+	  return FALSE;
+	}
+    }
+
+  return TRUE;
+}
+
+static GPtrArray *
+parse_source (const gchar *contents, gsize length, GError **error)
+{
+  GPtrArray *entries;
+  const gchar *p, *end = contents + length;
+  guint lineno = 0;
+
+  entries = g_ptr_array_new_with_free_func ((GDestroyNotify) entry_free);
+  for (p = contents; p < end; )
+    {
+      const gchar *eol, *next, *tab, *line_end;
+      GString *key, *value;
+      GError *local_error = NULL;
+      Entry *entry;
+
+      lineno++;
+      eol = memchr (p, '\n', end - p);
+      if (eol == NULL)
+	eol = end;
+      next = eol < end ? eol + 1 : end;
+      line_end = eol;
+      if (line_end > p && line_end[-1] == '\r')
+	line_end--;
+
+      if (line_end == p || *p == '#')
+	{
+	  p = next;
+	  continue;
+	}
+
+      tab = memchr (p, '\t', line_end - p);
+      if (tab == NULL)
+	{
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "line %u: missing tab", lineno);
+	  goto out;
+	}
+
+      key = g_string_new ("");
+      value = g_string_new ("");
+      if (!unescape (p, tab, key, &local_error)
+	  || !unescape (tab + 1, line_end, value, &local_error))
+	{
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "line %u: %s", lineno, local_error->message);
+	  g_error_free (local_error);
+	  g_string_free (key, TRUE);
+	  g_string_free (value, TRUE);
+	  goto out;
+	}
+
+      if (key->len == 0
+	  || !g_utf8_validate (key->str, key->len, NULL)
+	  || !g_utf8_validate (value->str, value->len, NULL))
+	{
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "line %u: empty key or invalid UTF-8", lineno);
+	  g_string_free (key, TRUE);
+	  g_string_free (value, TRUE);
+	  goto out;
+	}
+
+      entry = g_slice_new (Entry);
+      entry->key = g_string_free (key, FALSE);
+      entry->value = g_string_free (value, FALSE);
+      entry->lineno = lineno;
+      g_ptr_array_add (entries, entry);
+
+      p = next;
+    }
+
+  return entries;
+
+ out:
+  g_ptr_array_unref (entries);
+  return NULL;
+}
+
+static gint
+compare_entries (gconstpointer a, gconstpointer b)
+{
+  const Entry *ea = *(const Entry **) a, *eb = *(const Entry **) b;
+  gint retval;
+
+  /* strcmp compares as unsigned char, i.e. in UTF-8 byte order.  */
+  retval = strcmp (ea->key, eb->key);
+  if (retval == 0)
+    retval = ea->lineno < eb->lineno ? -1 : 1;
+  return retval;
+}
+
+static gint
+add_node (GArray *nodes, guchar label)
+{
+  Node node;
+
+  node.label = label;
+  node.first_child = node.last_child = node.next_sibling = -1;
+  node.value = TABLE_NO_VALUE;
+  g_array_append_val (nodes, node);
+  return nodes->len - 1;
+}
+
+/* Build a trie of ENTRIES, which must be sorted, storing the outputs
+ * in POOL.  */
+static GArray *
+build_trie (GPtrArray *entries, GString *pool)
+{
+  GArray *nodes;
+  GHashTable *offsets;
+  guint i;
+
+  nodes = g_array_new (FALSE, FALSE, sizeof (Node));
+  add_node (nodes, 0);
+
+  offsets = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < entries->len; i++)
+    {
+      Entry *entry = g_ptr_array_index (entries, i);
+      const guchar *p;
+      gint index = 0;
+      gpointer offset;
+
+      for (p = (const guchar *) entry->key; *p; p++)
+	{
+	  Node *node = &g_array_index (nodes, Node, index);
+	  gint child = node->last_child;
+
+	  /* Since the keys are sorted, the only child which may match
+	   * is the last one.  */
+	  if (child < 0 || g_array_index (nodes, Node, child).label != *p)
+	    {
+	      child = add_node (nodes, *p);
+	      node = &g_array_index (nodes, Node, index);
+	      if (node->last_child < 0)
+		node->first_child = child;
+	      else
+		g_array_index (nodes, Node, node->last_child).next_sibling =
+		  child;
+	      node->last_child = child;
+	    }
+	  index = child;
+	}
+
+      if (!g_hash_table_lookup_extended (offsets, entry->value,
+					 NULL, &offset))
+	{
+	  guint32 length = strlen (entry->value);
+
+	  offset = GUINT_TO_POINTER (pool->len);
+	  g_string_append_len (pool, (const gchar *) &length, sizeof (length));
+	  g_string_append_len (pool, entry->value, length);
+	  g_hash_table_insert (offsets, entry->value, offset);
+	}
+      g_array_index (nodes, Node, index).value = GPOINTER_TO_UINT (offset);
+    }
+  g_hash_table_destroy (offsets);
+
+  return nodes;
+}
+
+static void
+ensure_states (GArray *base, GArray *check, GArray *value, guint n_states)
+{
+  static const gint32 no_check = -1;
+  static const guint32 no_value = TABLE_NO_VALUE;
+
+  if (n_states <= base->len)
+    return;
+
+  g_array_set_size (base, n_states);
+  while (check->len < n_states)
+    g_array_append_val (check, no_check);
+  while (value->len < n_states)
+    g_array_append_val (value, no_value);
+}
+
+/* Lay out the trie NODES as a double array, assigning states in
+ * breadth-first order and choosing for each state the smallest base
+ * at which all its children fit.  */
+static guint
+place_nodes (GArray *nodes, GArray *base, GArray *check, GArray *value)
+{
+  GQueue queue = G_QUEUE_INIT;
+  guint n_states = 1, first_free = 1;
+
+  ensure_states (base, check, value, 256);
+  g_array_index (check, gint32, 0) = 0;
+
+  /* The queue holds pairs of a node and its state.  */
+  g_queue_push_tail (&queue, GINT_TO_POINTER (0));
+  g_queue_push_tail (&queue, GINT_TO_POINTER (0));
+  while (!g_queue_is_empty (&queue))
+    {
+      gint index = GPOINTER_TO_INT (g_queue_pop_head (&queue));
+      gint state = GPOINTER_TO_INT (g_queue_pop_head (&queue));
+      Node *node = &g_array_index (nodes, Node, index);
+      guchar first_label;
+      gint child;
+      guint b;
+
+      g_array_index (value, guint32, state) = node->value;
+      if (node->first_child < 0)
+	continue;
+
+      while (first_free < check->len
+	     && g_array_index (check, gint32, first_free) >= 0)
+	first_free++;
+
+      first_label = g_array_index (nodes, Node, node->first_child).label;
+      for (b = MAX (first_free, (guint) first_label + 1) - first_label; ; b++)
+	{
+	  for (child = node->first_child; child >= 0;
+	       child = g_array_index (nodes, Node, child).next_sibling)
+	    {
+	      guint t = b + g_array_index (nodes, Node, child).label;
+
+	      ensure_states (base, check, value, t + 1);
+	      if (g_array_index (check, gint32, t) >= 0)
+		break;
+	    }
+	  if (child < 0)
+	    break;
+	}
+
+      g_array_index (base, gint32, state) = b;
+      for (child = node->first_child; child >= 0;
+	   child = g_array_index (nodes, Node, child).next_sibling)
+	{
+	  guint t = b + g_array_index (nodes, Node, child).label;
+
+	  g_array_index (check, gint32, t) = state;
+	  n_states = MAX (n_states, t + 1);
+	  g_queue_push_tail (&queue, GINT_TO_POINTER (child));
+	  g_queue_push_tail (&queue, GUINT_TO_POINTER (t));
+	}
+    }
+
+  return n_states;
+}
+
+static gboolean
+compile (const gchar *source, const gchar *output, GError **error)
+{
+  GPtrArray *entries;
+  GArray *nodes, *base, *check, *value;
+  GString *pool, *contents;
+  TableHeader header;
+  gchar *source_contents;
+  gsize length;
+  gboolean retval = FALSE;
+  guint i, n_states;
+
+  if (!g_file_get_contents (source, &source_contents, &length, error))
+    return FALSE;
+
+  entries = parse_source (source_contents, length, error);
+  g_free (source_contents);
+  if (entries == NULL)
+    return FALSE;
+
+  g_ptr_array_sort (entries, compare_entries);
+  for (i = 1; i < entries->len; i++)
+    {
+      Entry *prev = g_ptr_array_index (entries, i - 1);
+      Entry *entry = g_ptr_array_index (entries, i);
+
+      if (strcmp (prev->key, entry->key) == 0)
+	{
+	  g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+		       "line %u: duplicate key (first defined at line %u)",
+		       entry->lineno, prev->lineno);
+	  goto out;
+	}
+    }
+
+  pool = g_string_new ("");
+  nodes = build_trie (entries, pool);
+
+  base = g_array_new (FALSE, TRUE, sizeof (gint32));
+  check = g_array_new (FALSE, FALSE, sizeof (gint32));
+  value = g_array_new (FALSE, FALSE, sizeof (guint32));
+  n_states = place_nodes (nodes, base, check, value);
+  g_array_free (nodes, TRUE);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, TABLE_MAGIC, sizeof (header.magic));
+  header.version = TABLE_VERSION;
+  header.byte_order = TABLE_BYTE_ORDER;
+  header.n_states = n_states;
+  header.pool_size = pool->len;
+
+  contents = g_string_new ("");
+  g_string_append_len (contents, (const gchar *) &header, sizeof (header));
+  g_string_append_len (contents, base->data, n_states * sizeof (gint32));
+  g_string_append_len (contents, check->data, n_states * sizeof (gint32));
+  g_string_append_len (contents, value->data, n_states * sizeof (guint32));
+  g_string_append_len (contents, pool->str, pool->len);
+
+  retval = g_file_set_contents (output, contents->str, contents->len, error);
+
+  g_string_free (contents, TRUE);
+  g_array_free (base, TRUE);
+  g_array_free (check, TRUE);
+  g_array_free (value, TRUE);
+  g_string_free (pool, TRUE);
+
+ out:
+  g_ptr_array_unref (entries);
+
+  return retval;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+
+  context = g_option_context_new ("SOURCE OUTPUT - compile a table");
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (argc != 3)
+    {
+      g_printerr ("Usage: %s SOURCE OUTPUT\n", g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+
+  if (!compile (argv[1], argv[2], &error))
+    {
+      g_printerr ("%s: %s\n", argv[1], error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2012 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Write the module cache of each directory given on the command line,
+ * or of the default module directory.  */
+
+#include "config.h"
+#include <libtranslit/translit.h>
+#include <stdlib.h>
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gint i, status = EXIT_SUCCESS;
+
+  context = g_option_context_new ("[DIRECTORY...] - update module caches");
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (argc < 2)
+    {
+      if (!translit_update_module_cache (MODULEDIR, &error))
+	{
+	  g_printerr ("%s: %s\n", MODULEDIR, error->message);
+	  g_error_free (error);
+	  status = EXIT_FAILURE;
+	}
+      return status;
+    }
+
+  for (i = 1; i < argc; i++)
+    if (!translit_update_module_cache (argv[i], &error))
+      {
+	g_printerr ("%s: %s\n", argv[i], error->message);
+	g_clear_error (&error);
+	status = EXIT_FAILURE;
+      }
+
+  return status;
+}